@@ -0,0 +1,92 @@
+/**
+ * @file farmem.h
+ * @brief Heap allocator for memory outside of bank 0
+ *
+ * Allocates blocks from the 28-bit address space, e.g. chip RAM banks 4 and 5
+ * or the 8 MB attic (HyperRAM). Blocks are handed out as 28-bit addresses
+ * that can be used with `lcopy()`, `lpeek()` etc. from memory.h.
+ *
+ * Memory is managed in 256 byte units. Free blocks are kept in size-class
+ * lists and are merged with their neighbours when released, so that
+ * programs can load and unload data without fragmenting the heap. All
+ * bookkeeping lives in a small table in bank 0; nothing is written to the
+ * managed memory itself.
+ */
+#ifndef __MEGA65_FARMEM_H
+#define __MEGA65_FARMEM_H
+
+#include <stdint.h>
+
+/// Start of chip RAM bank 4
+#define FARMEM_CHIP_BASE 0x40000UL
+/// Size of chip RAM banks 4 and 5
+#define FARMEM_CHIP_SIZE 0x20000UL
+/// Start of attic RAM (HyperRAM)
+#define FARMEM_ATTIC_BASE 0x8000000UL
+/// Size of attic RAM (HyperRAM)
+#define FARMEM_ATTIC_SIZE 0x800000UL
+
+/// Maximum number of regions that can be added with `lmalloc_add()`
+#ifndef FARMEM_REGIONS
+#define FARMEM_REGIONS 4
+#endif
+
+/// Size of the block table; limits the number of used and free blocks
+#ifndef FARMEM_BLOCKS
+#define FARMEM_BLOCKS 48
+#endif
+
+#ifdef __cplusplus
+// Being compiled by a C++ compiler, inhibit name mangling
+extern "C" {
+#endif
+
+/**
+ * @brief Reset the heap, dropping all regions and allocations
+ */
+void lmalloc_init(void);
+
+/**
+ * @brief Add a region of memory to the heap
+ * @param start 28-bit start address; rounded up to a multiple of 256
+ * @param size Size in bytes; at most 16 MB
+ * @return 1 on success, 0 if the region is too small or the tables are full
+ *
+ * If `lmalloc()` is called before any region has been added, chip RAM banks
+ * 4 and 5 are used. Note that these banks are also used by fcio.h for
+ * graphics, so programs using both should add other regions instead, e.g.
+ * `lmalloc_add(FARMEM_ATTIC_BASE, FARMEM_ATTIC_SIZE)` on machines with attic
+ * RAM.
+ */
+uint8_t lmalloc_add(uint32_t start, uint32_t size);
+
+/**
+ * @brief Allocate a block of far memory
+ * @param size Number of bytes
+ * @return 28-bit address of the block, or 0 if no block is large enough
+ */
+uint32_t lmalloc(uint32_t size);
+
+/**
+ * @brief Release a block allocated with `lmalloc()` or `lrealloc()`
+ * @param address 28-bit address of the block; 0 is ignored
+ */
+void lfree(uint32_t address);
+
+/**
+ * @brief Resize a block of far memory
+ * @param address 28-bit address of the block, or 0 to allocate a new block
+ * @param size New size in bytes; 0 releases the block
+ * @return 28-bit address of the block, or 0 on failure in which case the
+ * original block is left untouched
+ *
+ * The block is resized in place if possible; otherwise the contents are
+ * moved to a new block with DMA.
+ */
+uint32_t lrealloc(uint32_t address, uint32_t size);
+
+#ifdef __cplusplus
+} // End of extern "C"
+#endif
+
+#endif // __MEGA65_FARMEM_H
@@ -0,0 +1,198 @@
+/**
+ * @file fat32.h
+ * @brief FAT32 file system driver working directly on the SD card
+ *
+ * Unlike fileio.h, which goes through the hypervisor and delivers 512 bytes
+ * per call, this driver reads the file system itself with the functions in
+ * sdcard.h. Whole sectors of a file are read with multi-sector transfers
+ * straight to far memory, so large files stream without passing through
+ * bank 0. Directory and FAT sectors are read through sdcache.h.
+ *
+ * Only one volume can be mounted at a time. Files are opened by path, with
+ * directories separated by `/`; names are matched without regard to case,
+ * against both the 8.3 and the long file name.
+ *
+ * The first lookup in a directory reads all of its entries, long names
+ * included, into a hashed name index in far memory, allocated with
+ * `lmalloc()`. Later lookups in the same directory do not read the card.
+ * The indexes of the `MEGA65_FAT32_INDEX_DIRS` most recently used
+ * directories are kept; a directory that does not fit into memory is
+ * searched entry by entry.
+ *
+ * The list of free clusters, the name indexes and the cluster runs of open
+ * files all live in memory allocated with `lmalloc()`, by default chip RAM
+ * banks 4 and 5. Files must therefore not be read, or otherwise copied with
+ * DMA, into a region added to the heap with `lmalloc_add()`, unless the
+ * memory was allocated for that purpose with `lmalloc()`.
+ */
+#ifndef __MEGA65_FAT32_H
+#define __MEGA65_FAT32_H
+
+#include <stdint.h>
+
+/// Longest long file name that can be matched; longer names match by 8.3
+#ifndef MEGA65_FAT32_NAME_MAX
+#define MEGA65_FAT32_NAME_MAX 64
+#endif
+
+/// Number of directories whose name index is kept at a time
+#ifndef MEGA65_FAT32_INDEX_DIRS
+#define MEGA65_FAT32_INDEX_DIRS 4
+#endif
+
+/// Returned by `mega65_fat32_read()` on error
+#define MEGA65_FAT32_READ_ERROR 0xffffffffUL
+
+/// Directory entry attribute: read only
+#define MEGA65_FAT32_ATTR_READ_ONLY 0x01
+/// Directory entry attribute: hidden
+#define MEGA65_FAT32_ATTR_HIDDEN 0x02
+/// Directory entry attribute: system
+#define MEGA65_FAT32_ATTR_SYSTEM 0x04
+/// Directory entry attribute: directory
+#define MEGA65_FAT32_ATTR_DIRECTORY 0x10
+/// Directory entry attribute: archive
+#define MEGA65_FAT32_ATTR_ARCHIVE 0x20
+
+#ifdef __cplusplus
+// Being compiled by a C++ compiler, inhibit name mangling
+extern "C" {
+#endif
+
+/**
+ * @brief An open file
+ *
+ * Filled in by `mega65_fat32_open()`. The fields may be read, but should
+ * only be changed through the functions below.
+ *
+ * When a file is opened, its cluster chain is followed once to build a list
+ * of the runs of consecutive clusters in far memory, so that any offset can
+ * be found without following the chain again. If the list does not fit,
+ * `runs` is 0 and the chain is followed from `cluster` instead.
+ */
+struct mega65_fat32_file {
+    uint32_t first_cluster; //!< First cluster of the data, 0 if empty
+    uint32_t size;          //!< Size in bytes
+    uint32_t position;      //!< Offset of the next byte to read
+    uint32_t cluster;       //!< Last cluster found by following the chain
+    uint32_t cluster_index; //!< Index of `cluster` within the file
+    uint32_t runs;          //!< 28-bit address of the run list, or 0
+    uint16_t run_count;     //!< Number of runs in the list
+    uint16_t run;           //!< Run used last
+    uint32_t entry_sector;  //!< Sector holding the directory entry
+    uint16_t entry_offset;  //!< Offset of the entry within the sector
+    uint8_t attributes;     //!< `MEGA65_FAT32_ATTR_*` flags
+};
+
+/**
+ * @brief Mount a FAT32 partition of the SD card
+ * @param partition Entry in the MBR partition table, 0-3
+ * @return 0 on success, 0xff on error
+ *
+ * The SD card must have been opened with `mega65_sdcard_open()`. Only the
+ * boot sector and BIOS parameter block are read, so mounting is quick even
+ * on large volumes.
+ *
+ * The first time clusters are allocated, or `mega65_fat32_free_clusters()`
+ * is called, the whole first FAT is read once to build a list of the runs
+ * of free clusters in far memory, allocated with `lmalloc()`, so that
+ * contiguous space can then be found without reading the FAT again. This
+ * takes time in proportion to the size of the FAT; read-only use never
+ * pays for it.
+ */
+uint8_t mega65_fat32_mount(const uint8_t partition);
+
+/**
+ * @brief Open a file or directory on the mounted volume
+ * @param file File to fill in
+ * @param path Path from the root directory, e.g. `"GAME/LEVEL1.DAT"`
+ * @return 0 on success, 0xff if not found or on error
+ *
+ * Call `mega65_fat32_close()` when done, to release the run list.
+ */
+uint8_t mega65_fat32_open(struct mega65_fat32_file* file, const char* path);
+
+/**
+ * @brief Read from a given offset of a file to far memory
+ * @param file Open file
+ * @param offset Offset from the start of the file
+ * @param destination 28-bit address to read to
+ * @param length Number of bytes to read
+ * @return Number of bytes read, which is less than `length` at the end of
+ * the file, or `MEGA65_FAT32_READ_ERROR`
+ *
+ * Whole sectors are read with `mega65_sdcard_readsectors()`, each run of
+ * consecutive clusters as one transfer; only a partial first or last sector
+ * passes through `sector_buffer`. The run holding `offset` is looked up in
+ * the run list of the file. The position of the file is not changed.
+ */
+uint32_t mega65_fat32_read_far(struct mega65_fat32_file* file,
+    uint32_t offset, const uint32_t destination, uint32_t length);
+
+/**
+ * @brief Read from the position of a file to far memory
+ * @param file Open file
+ * @param destination 28-bit address to read to
+ * @param length Number of bytes to read
+ * @return Number of bytes read, or `MEGA65_FAT32_READ_ERROR`
+ *
+ * As `mega65_fat32_read_far()`, and advances the position.
+ */
+uint32_t mega65_fat32_read(struct mega65_fat32_file* file,
+    const uint32_t destination, const uint32_t length);
+
+/**
+ * @brief Set the position of the next read
+ * @param file Open file
+ * @param offset Offset from the start of the file, at most its size
+ * @return 0 on success, 0xff if the offset is past the end of the file
+ */
+uint8_t mega65_fat32_seek(
+    struct mega65_fat32_file* file, const uint32_t offset);
+
+/**
+ * @brief Release the run list of a file
+ * @param file Open file
+ */
+void mega65_fat32_close(struct mega65_fat32_file* file);
+
+/**
+ * @brief Number of free clusters on the mounted volume
+ *
+ * Counts the clusters in the list of free clusters, which is built by the
+ * first call after mounting; see `mega65_fat32_mount()`. Runs that did not
+ * fit into memory are not included.
+ */
+uint32_t mega65_fat32_free_clusters(void);
+
+/**
+ * @brief Create a contiguous file in the root directory
+ * @param name 8.3 name padded with spaces, e.g. `"MEGA65  D81"`
+ * @param size Size in bytes
+ * @param root_dir_sector First sector of the root directory, cluster 2
+ * @param fat1_sector First sector of the first FAT
+ * @param fat2_sector First sector of the second FAT
+ * @return First sector of the file, or 0xffffffff on failure
+ *
+ * Used when formatting a card. Unless the mounted volume has its first FAT
+ * at `fat1_sector`, the partition with that FAT is mounted, so that the
+ * cluster size is taken from its BIOS parameter block; if there is none,
+ * the given layout is mounted with 4 kB clusters. The clusters are taken
+ * from the list of free clusters, built if needed, and may span any
+ * number of FAT sectors; whole FAT sectors are written with multi-sector
+ * writes. The root directory is given another cluster if it is full. If the
+ * entry cannot be written, the clusters are freed again. The cache of
+ * sdcache.h is flushed before returning.
+ *
+ * Files opened on a different volume that was mounted before must be closed
+ * before calling this, as that volume is no longer mounted afterwards.
+ */
+unsigned long mega65_fat32_create_contiguous_file(char* name,
+    unsigned long size, unsigned long root_dir_sector,
+    unsigned long fat1_sector, unsigned long fat2_sector);
+
+#ifdef __cplusplus
+} // End of extern "C"
+#endif
+
+#endif // __MEGA65_FAT32_H
@@ -18,6 +18,20 @@ extern "C" {
  */
 void usleep(uint32_t micros);
 
+/**
+ * @brief Start a free-running 32-bit tick counter
+ *
+ * Chains CIA 2 timers A and B. A tick is one CIA clock cycle (~1 us). The
+ * counter wraps after ~71 minutes.
+ */
+void hal_timer_start(void);
+
+/**
+ * @brief Ticks since `hal_timer_start()`
+ * @return Elapsed CIA clock cycles; subtract two readings to time a section
+ */
+uint32_t hal_timer_ticks(void);
+
 #ifdef __cplusplus
 } // End of extern "C"
 #endif
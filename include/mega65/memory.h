@@ -11,16 +11,45 @@
 #include <stdint.h>
 #include <stddef.h>
 
-#define DMA_COPY_CMD 0x00; //!< DMA copy command
-#define DMA_MIX_CMD 0x01;  //!< DMA mix command (unimplemented)
-#define DMA_SWAP_CMD 0x02; //!< DMA swap command (unimplemented)
-#define DMA_FILL_CMD 0x03; //!< DMA fill command
-
-#define DMA_LINEAR_ADDR 0x00; //!< DMA linear (normal) addressing mode
-#define DMA_MODULO_ADDR 0x01; //!< DMA modulo (rectangular) addressing mode
-#define DMA_HOLD_ADDR 0x02;   //!< DMA hold (constant address) addressing mode
+#define DMA_COPY_CMD 0x00 //!< DMA copy command
+#define DMA_MIX_CMD 0x01  //!< DMA mix command
+#define DMA_SWAP_CMD 0x02 //!< DMA swap command
+#define DMA_FILL_CMD 0x03 //!< DMA fill command
+#define DMA_CHAIN 0x04    //!< Command bit: another job follows this one
+
+#define DMA_MINTERM_NSA_NDA 0x10 //!< Mix minterm: !source & !destination
+#define DMA_MINTERM_NSA_DA 0x20  //!< Mix minterm: !source & destination
+#define DMA_MINTERM_SA_NDA 0x40  //!< Mix minterm: source & !destination
+#define DMA_MINTERM_SA_DA 0x80   //!< Mix minterm: source & destination
+#define DMA_MIX_AND 0x80         //!< Mix: destination = source AND destination
+#define DMA_MIX_OR 0xe0          //!< Mix: destination = source OR destination
+#define DMA_MIX_XOR 0x60         //!< Mix: destination = source XOR destination
+
+#define DMA_DECREMENT 0x40 //!< Bank flag: step the address downwards
+
+#define DMA_LINEAR_ADDR 0x00 //!< DMA linear (normal) addressing mode
+#define DMA_MODULO_ADDR 0x01 //!< DMA modulo (rectangular) addressing mode
+#define DMA_HOLD_ADDR 0x02   //!< DMA hold (constant address) addressing mode
 #define DMA_XYMOD_ADDR                                                         \
-    0x03; //!< DMA XY MOD (bitmap rectangular) addressing mode (unimplemented)
+    0x03 //!< DMA XY MOD (bitmap rectangular) addressing mode (unimplemented)
+
+/*
+ * Crossover sizes between the CPU loops and DMA. These are estimates from
+ * the 45GS02 instruction timings and have not yet been measured: the CPU
+ * loop costs about 20 cycles per copied byte and 12 per filled byte, while
+ * setting up and running a DMA job costs about 180 cycles before the first
+ * byte. bench-memory.c prints both timings for 1 to 32 bytes; override
+ * these at compile time with the sizes where DMA starts to win.
+ */
+
+/// Largest `lcopy()` done by the CPU instead of DMA
+#ifndef LCOPY_CPU_MAX
+#define LCOPY_CPU_MAX 8
+#endif
+/// Largest `lfill()` done by the CPU instead of DMA
+#ifndef LFILL_CPU_MAX
+#define LFILL_CPU_MAX 16
+#endif
 
 #ifdef __cplusplus
 // Being compiled by a C++ compiler, inhibit name mangling
@@ -129,6 +158,43 @@ __attribute__((leaf))
 #endif
 void lpoke(uint32_t address, uint8_t value);
 
+#ifdef __llvm__
+/**
+ * @brief Inlined version of `lpoke()`
+ * @param ADDRESS 28-bit address; must be a compile-time constant.
+ * @param value Single byte to write to the given address
+ * @warning This function is experimental and may change/be removed in future
+ * versions
+ */
+inline void lpoke_i(const uint32_t ADDRESS, const uint8_t value)
+{
+    // Helper to (dis)assemble 32-bit int; optimizes out fully
+    const union {
+        uint32_t value;
+        uint8_t byte[4];
+    } adr = { ADDRESS };
+
+    __attribute__((leaf)) __asm__ volatile(
+        "lda #%1        \n" // constant address -> rc2-5
+        "sta __rc2      \n"
+        "lda #%2        \n"
+        "sta __rc3      \n"
+        "lda #%3        \n"
+        "sta __rc4      \n"
+        "lda #%4        \n"
+        "sta __rc5      \n"
+        "txa            \n"
+        "ldz #0         \n"
+        "sta [__rc2], z \n"
+        :
+        : "x"(value), "i"(adr.byte[0]), "i"(adr.byte[1]), "i"(adr.byte[2]),
+        "i"(adr.byte[3])
+        : "a", "rc2", "rc3", "rc4", "rc5", "p");
+}
+#else
+#define lpoke_i(ADDRESS, VALUE) lpoke(ADDRESS, VALUE)
+#endif
+
 /**
  * @brief Poke a byte to the given address using DMA copy
  * @param address 28-bit address
@@ -138,21 +204,69 @@ void lpoke(uint32_t address, uint8_t value);
 void dma_poke(uint32_t address, uint8_t value);
 
 /**
- * @brief Copy a block of memory using DMA
+ * @brief Copy a block of memory
  * @param source_address 28-bit address to copy from
  * @param destination_address 28-bit address to copy to
  * @param count Number of bytes to copy. Note that 0 = 64 kB.
+ *
+ * Blocks of up to `LCOPY_CPU_MAX` bytes are copied by the CPU with
+ * `lcopy_cpu()` as this is faster than setting up a DMA job; larger blocks
+ * use DMA.
  */
 void lcopy(uint32_t source_address, uint32_t destination_address, size_t count);
 
 /**
- * @brief Fill a block of memory with a single byte using DMA
+ * @brief Copy a block of memory using DMA regardless of its size
+ * @param source_address 28-bit address to copy from
+ * @param destination_address 28-bit address to copy to
+ * @param count Number of bytes to copy. Note that 0 = 64 kB.
+ */
+void lcopy_dma(
+    uint32_t source_address, uint32_t destination_address, size_t count);
+
+/**
+ * @brief Copy up to 256 bytes using 32-bit indirect CPU loads and stores
+ * @param source_address 28-bit address to copy from
+ * @param destination_address 28-bit address to copy to
+ * @param count Number of bytes to copy. Note that 0 = 256 bytes.
+ */
+#ifdef __clang__
+__attribute__((leaf))
+#endif
+void lcopy_cpu(
+    uint32_t source_address, uint32_t destination_address, uint8_t count);
+
+/**
+ * @brief Fill a block of memory with a single byte
  * @param destination_address Start address (28-bit)
  * @param value Fill value
  * @param count Number of bytes to fill. Note that 0 = 64 kB.
+ *
+ * Blocks of up to `LFILL_CPU_MAX` bytes are filled by the CPU with
+ * `lfill_cpu()`; larger blocks use DMA.
  */
 void lfill(uint32_t destination_address, uint8_t value, size_t count);
 
+/**
+ * @brief Fill a block of memory with a single byte using DMA regardless of
+ * its size
+ * @param destination_address Start address (28-bit)
+ * @param value Fill value
+ * @param count Number of bytes to fill. Note that 0 = 64 kB.
+ */
+void lfill_dma(uint32_t destination_address, uint8_t value, size_t count);
+
+/**
+ * @brief Fill up to 256 bytes using 32-bit indirect CPU stores
+ * @param destination_address Start address (28-bit)
+ * @param value Fill value
+ * @param count Number of bytes to fill. Note that 0 = 256 bytes.
+ */
+#ifdef __clang__
+__attribute__((leaf))
+#endif
+void lfill_cpu(uint32_t destination_address, uint8_t value, uint8_t count);
+
 /**
  * @brief Fill a block of memory with a single byte using DMA with a step
  * @param destination_address Start address (28-bit)
@@ -163,6 +277,268 @@ void lfill(uint32_t destination_address, uint8_t value, size_t count);
 void lfill_skip(
     uint32_t destination_address, uint8_t value, size_t count, uint8_t skip);
 
+/**
+ * @brief Fill a block of memory with a 16-bit pattern using DMA
+ * @param destination_address Start address (28-bit)
+ * @param pattern Fill value; the low byte is written first
+ * @param count Number of 16-bit values to fill. Note that 0 = 64 k values.
+ *
+ * Useful for screen code and attribute pairs in 16-bit text mode. The two
+ * byte lanes are filled by two chained jobs with a single trigger.
+ */
+void lfill16(uint32_t destination_address, uint16_t pattern, size_t count);
+
+/**
+ * @brief Fill a block of memory with a 32-bit pattern using DMA
+ * @param destination_address Start address (28-bit)
+ * @param pattern Fill value; the low byte is written first
+ * @param count Number of 32-bit values to fill. Note that 0 = 64 k values.
+ *
+ * See `lfill16()`; this uses four chained jobs.
+ */
+void lfill32(uint32_t destination_address, uint32_t pattern, size_t count);
+
+/**
+ * @brief Copy a block of memory using DMA, allowing the blocks to overlap
+ * @param source_address 28-bit address to copy from
+ * @param destination_address 28-bit address to copy to
+ * @param count Number of bytes to copy. Note that 0 = 64 kB.
+ *
+ * Like `memmove()`: if the destination overlaps the end of the source, the
+ * block is copied from its last byte downwards in a single DMA job.
+ * Both blocks must lie within the same 1 MB region each.
+ */
+void lmove(uint32_t source_address, uint32_t destination_address, size_t count);
+
+/**
+ * @brief Copy bytes using DMA with independent source and destination steps
+ * @param source_address 28-bit address to copy from
+ * @param source_step Distance in bytes between consecutive source bytes
+ * @param destination_address 28-bit address to copy to
+ * @param destination_step Distance in bytes between consecutive destination
+ * bytes
+ * @param count Number of bytes to copy. Note that 0 = 64 kB.
+ *
+ * Useful for gathering or scattering interleaved data, e.g. writing only the
+ * low bytes of a 16-bit character screen row with a destination step of 2.
+ */
+void lcopy_skip(uint32_t source_address, uint8_t source_step,
+    uint32_t destination_address, uint8_t destination_step, size_t count);
+
+/**
+ * @brief Exchange two blocks of memory in a single DMA pass
+ * @param address1 28-bit address of first block
+ * @param address2 28-bit address of second block
+ * @param count Number of bytes to exchange. Note that 0 = 64 kB.
+ * @note The blocks must not overlap.
+ */
+void lswap(uint32_t address1, uint32_t address2, size_t count);
+
+/**
+ * @brief Combine a source block into a destination block using DMA mix
+ * @param source_address 28-bit address of source block
+ * @param destination_address 28-bit address of destination block
+ * @param count Number of bytes to mix. Note that 0 = 64 kB.
+ * @param minterms Logic function as an OR of `DMA_MINTERM_*` bits, e.g.
+ * `DMA_MIX_XOR`
+ *
+ * Each destination byte is replaced by the sum of the selected minterms of
+ * the source and destination bytes.
+ */
+void lmix(uint32_t source_address, uint32_t destination_address,
+    size_t count, uint8_t minterms);
+
+/**
+ * @brief Copy a rectangular block of memory using DMA
+ * @param source_address 28-bit address of the top-left source byte
+ * @param source_stride Distance in bytes between source rows
+ * @param destination_address 28-bit address of the top-left destination byte
+ * @param destination_stride Distance in bytes between destination rows
+ * @param width Number of bytes per row
+ * @param rows Number of rows
+ *
+ * The rows are issued as chained DMA jobs with a single trigger per batch of
+ * rows. If the destination lies above the source, rows are copied bottom-up
+ * so that overlapping rectangles, e.g. when scrolling, are moved correctly.
+ * Each row is moved with `lmove()` semantics, so a rectangle may also be
+ * shifted sideways within its rows. If both strides equal the width, the
+ * rectangle is contiguous and is moved as a single job.
+ */
+void lcopy_rect(uint32_t source_address, uint16_t source_stride,
+    uint32_t destination_address, uint16_t destination_stride, size_t width,
+    uint8_t rows);
+
+/**
+ * @brief Fill a rectangular block of memory with a single byte using DMA
+ * @param destination_address 28-bit address of the top-left byte
+ * @param stride Distance in bytes between rows
+ * @param value Fill value
+ * @param width Number of bytes per row
+ * @param rows Number of rows
+ */
+void lfill_rect(uint32_t destination_address, uint16_t stride, uint8_t value,
+    size_t width, uint8_t rows);
+
+/**
+ * @brief Batch of chained DMA jobs
+ *
+ * Jobs are appended to a caller-supplied arena of DMA lists and executed
+ * with a single DMA trigger by `dma_batch_submit()`. Each job carries its own
+ * enhanced option list, and all but the last have the `DMA_CHAIN` bit set.
+ */
+struct dma_batch {
+    struct dmagic_dmalist* jobs; //!< Job arena; must be in bank 0
+    uint8_t capacity;            //!< Number of jobs the arena can hold
+    uint8_t count;               //!< Number of jobs queued
+};
+
+/**
+ * @brief Start a new batch of chained DMA jobs
+ * @param batch Batch to initialise
+ * @param arena Array of `capacity` DMA lists located in bank 0
+ * @param capacity Number of jobs the arena can hold
+ */
+void dma_batch_begin(struct dma_batch* batch, struct dmagic_dmalist* arena,
+    uint8_t capacity);
+
+/**
+ * @brief Append a copy job to a batch
+ * @param batch Batch to append to
+ * @param source_address 28-bit address to copy from
+ * @param destination_address 28-bit address to copy to
+ * @param count Number of bytes to copy. Note that 0 = 64 kB.
+ * @note If the arena is full, the queued jobs are submitted first.
+ */
+void dma_batch_copy(struct dma_batch* batch, uint32_t source_address,
+    uint32_t destination_address, size_t count);
+
+/**
+ * @brief Append an overlap-safe copy job to a batch
+ *
+ * See `lmove()` for the parameters.
+ */
+void dma_batch_move(struct dma_batch* batch, uint32_t source_address,
+    uint32_t destination_address, size_t count);
+
+/**
+ * @brief Append a fill job to a batch
+ * @param batch Batch to append to
+ * @param destination_address Start address (28-bit)
+ * @param value Fill value
+ * @param count Number of bytes to fill. Note that 0 = 64 kB.
+ * @note If the arena is full, the queued jobs are submitted first.
+ */
+void dma_batch_fill(struct dma_batch* batch, uint32_t destination_address,
+    uint8_t value, size_t count);
+
+/**
+ * @brief Append a fill job with a destination step to a batch
+ * @param batch Batch to append to
+ * @param destination_address Start address (28-bit)
+ * @param value Fill value
+ * @param count Number of bytes to fill. Note that 0 = 64 kB.
+ * @param skip Skip every n bytes
+ * @note If the arena is full, the queued jobs are submitted first.
+ */
+void dma_batch_fill_skip(struct dma_batch* batch, uint32_t destination_address,
+    uint8_t value, size_t count, uint8_t skip);
+
+/**
+ * @brief Append a swap job to a batch
+ * @param batch Batch to append to
+ * @param address1 28-bit address of first block
+ * @param address2 28-bit address of second block
+ * @param count Number of bytes to exchange. Note that 0 = 64 kB.
+ * @note If the arena is full, the queued jobs are submitted first.
+ */
+void dma_batch_swap(struct dma_batch* batch, uint32_t address1,
+    uint32_t address2, size_t count);
+
+/**
+ * @brief Append the row copies of a rectangle to a batch
+ *
+ * See `lcopy_rect()` for the parameters and row ordering.
+ */
+void dma_batch_copy_rect(struct dma_batch* batch, uint32_t source_address,
+    uint16_t source_stride, uint32_t destination_address,
+    uint16_t destination_stride, size_t width, uint8_t rows);
+
+/**
+ * @brief Append a 16-bit pattern fill to a batch
+ *
+ * See `lfill16()` for the parameters. This appends two jobs.
+ */
+void dma_batch_fill16(struct dma_batch* batch, uint32_t destination_address,
+    uint16_t pattern, size_t count);
+
+/**
+ * @brief Append the row fills of a rectangle to a batch
+ * @param batch Batch to append to
+ * @param destination_address 28-bit address of the top-left byte
+ * @param stride Distance in bytes between rows
+ * @param value Fill value
+ * @param count Number of bytes to fill per row
+ * @param rows Number of rows
+ * @param skip Skip every n bytes within a row
+ *
+ * If the rows are back to back, i.e. `stride` equals `count * skip`, the
+ * rectangle is filled with a single job.
+ */
+void dma_batch_fill_rect(struct dma_batch* batch,
+    uint32_t destination_address, uint16_t stride, uint8_t value,
+    size_t count, uint8_t rows, uint8_t skip);
+
+/**
+ * @brief Execute all queued jobs of a batch with a single DMA trigger
+ * @param batch Batch to submit; it is empty afterwards and can be reused
+ */
+void dma_batch_submit(struct dma_batch* batch);
+
+/**
+ * @brief Run a DMA list that has been set up by the caller
+ * @param list DMA list in bank 0; jobs may be chained with `DMA_CHAIN`
+ */
+void dma_submit_list(const struct dmagic_dmalist* list);
+
+/**
+ * @brief Copy a block of memory using a constant DMA list
+ * @param SOURCE 28-bit address to copy from; must be a compile-time constant.
+ * @param DESTINATION 28-bit address to copy to; must be a compile-time
+ * constant.
+ * @param COUNT Number of bytes to copy; must be a compile-time constant.
+ *
+ * The DMA list is built by the compiler and placed in read-only data, so
+ * nothing is written at run time before the job is triggered.
+ */
+#define lcopy_i(SOURCE, DESTINATION, COUNT)                                    \
+    do {                                                                       \
+        static const struct dmagic_dmalist dma_list_                           \
+            = { 0x0b, 0x80, (uint8_t)((SOURCE) >> 20), 0x81,                   \
+                  (uint8_t)((DESTINATION) >> 20), 0x85, 1, 0x00,               \
+                  DMA_COPY_CMD, (COUNT), (uint16_t)(SOURCE),                   \
+                  (uint8_t)(((SOURCE) >> 16) & 0x0f), (uint16_t)(DESTINATION), \
+                  (uint8_t)(((DESTINATION) >> 16) & 0x0f), 0, 0 };             \
+        dma_submit_list(&dma_list_);                                           \
+    } while (0)
+
+/**
+ * @brief Fill a block of memory using a constant DMA list
+ * @param DESTINATION Start address (28-bit); must be a compile-time constant.
+ * @param VALUE Fill value; must be a compile-time constant.
+ * @param COUNT Number of bytes to fill; must be a compile-time constant.
+ *
+ * See `lcopy_i()`.
+ */
+#define lfill_i(DESTINATION, VALUE, COUNT)                                     \
+    do {                                                                       \
+        static const struct dmagic_dmalist dma_list_                           \
+            = { 0x0b, 0x80, 0x00, 0x81, (uint8_t)((DESTINATION) >> 20), 0x85, \
+                  1, 0x00, DMA_FILL_CMD, (COUNT), (uint8_t)(VALUE), 0x00,      \
+                  (uint16_t)(DESTINATION),                                     \
+                  (uint8_t)(((DESTINATION) >> 16) & 0x0f), 0, 0 };             \
+        dma_submit_list(&dma_list_);                                           \
+    } while (0)
+
 /// Poke a byte to the given address
 #define POKE(X, Y) (*(volatile uint8_t*)(X)) = Y
 /// Poke two bytes to the given address
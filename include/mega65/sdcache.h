@@ -0,0 +1,90 @@
+/**
+ * @file sdcache.h
+ * @brief Write-back sector cache in far memory
+ *
+ * Keeps recently used SD card sectors in 512 byte slots allocated with
+ * `lmalloc()` from farmem.h, so that repeated reads of e.g. FAT and
+ * directory sectors become DMA copies. Slots are found through a small hash
+ * table indexed by sector number and the least recently used slot is
+ * evicted on a miss. Written sectors are only sent to the card when evicted
+ * or when `sdcache_flush()` is called, with `mega65_sdcard_writesector()`
+ * and so under the write policy set in sdcard.h.
+ *
+ * The cache is optional: until `sdcache_init()` is called, the functions
+ * below read and write the card directly. Once enabled, all access to
+ * cached sectors should go through the cache.
+ */
+#ifndef __MEGA65_SDCACHE_H
+#define __MEGA65_SDCACHE_H
+
+#include <stdint.h>
+
+/// Maximum number of cache slots
+#ifndef SDCACHE_MAX_SLOTS
+#define SDCACHE_MAX_SLOTS 32
+#endif
+
+#ifdef __cplusplus
+// Being compiled by a C++ compiler, inhibit name mangling
+extern "C" {
+#endif
+
+/**
+ * @brief Cache counters
+ */
+struct sdcache_stats {
+    uint32_t hits;       //!< Reads and writes served by a cached slot
+    uint32_t misses;     //!< Reads that had to go to the card
+    uint32_t writebacks; //!< Dirty slots written to the card
+};
+
+extern struct sdcache_stats sdcache_stats;
+
+/**
+ * @brief Enable the cache
+ * @param slots Number of 512 byte slots; at most `SDCACHE_MAX_SLOTS`
+ * @return 1 on success, 0 if the slots could not be allocated
+ *
+ * Any previous cache is flushed and released first. Passing 0 disables the
+ * cache.
+ */
+uint8_t sdcache_init(uint8_t slots);
+
+/**
+ * @brief Read a sector into `sector_buffer` through the cache
+ * @param sector_number Sector to read
+ * @return 0 on success, 0xff on error
+ */
+uint8_t sdcache_read(uint32_t sector_number);
+
+/**
+ * @brief Write `sector_buffer` to a sector through the cache
+ * @param sector_number Sector to write
+ * @return 0 on success, 0xff on error
+ *
+ * The sector is marked dirty and written to the card later.
+ */
+uint8_t sdcache_write(uint32_t sector_number);
+
+/**
+ * @brief Drop cached copies of a range of sectors without writing them
+ * @param first_sector First sector of the range
+ * @param count Number of sectors
+ *
+ * For callers that write the sectors to the card directly, e.g. with
+ * `mega65_sdcard_writesectors()`, so that the cache does not keep stale
+ * copies. Unwritten changes to the sectors are lost.
+ */
+void sdcache_discard(uint32_t first_sector, uint32_t count);
+
+/**
+ * @brief Write all dirty slots to the card
+ * @return 0 on success, 0xff if any write failed
+ */
+uint8_t sdcache_flush(void);
+
+#ifdef __cplusplus
+} // End of extern "C"
+#endif
+
+#endif // __MEGA65_SDCACHE_H
@@ -7,21 +7,236 @@
 
 #include <stdint.h>
 
+/// Write policy: skip the write if the sector already holds the data
+#define SDCARD_WRITE_SKIP_IDENTICAL 0x01
+/// Write policy: read the sector back after writing and compare
+#define SDCARD_WRITE_VERIFY 0x02
+/// Write policy: retry if the card rejects the data, e.g. on a CRC error
+#define SDCARD_WRITE_CHECK_STATUS 0x04
+/// Write policy: trust the card's CRC check only
+#define SDCARD_WRITE_CRC_ONLY SDCARD_WRITE_CHECK_STATUS
+/// Write policy: write without any checks
+#define SDCARD_WRITE_NO_VERIFY 0x00
+/// Write policy used unless changed with `mega65_sdcard_set_write_policy()`
+#define SDCARD_WRITE_DEFAULT                                                   \
+    (SDCARD_WRITE_SKIP_IDENTICAL | SDCARD_WRITE_VERIFY                         \
+        | SDCARD_WRITE_CHECK_STATUS)
+
+/// Maximum number of sectors buffered by `mega65_sdcard_readahead()`
+#ifndef SDCARD_READAHEAD_MAX
+#define SDCARD_READAHEAD_MAX 8
+#endif
+
+/// Ticks of `hal_timer_ticks()` after which a submitted command fails (~1 s)
+#ifndef SDCARD_ASYNC_TIMEOUT
+#define SDCARD_ASYNC_TIMEOUT 1000000UL
+#endif
+
+/// Number of log2 bins in the latency histograms
+#define SDCARD_LATENCY_BINS 16
+
+/**
+ * @brief SD card counters and latency histograms
+ *
+ * Bin `n` of a histogram counts operations that took 2^n to 2^(n+1) - 1
+ * CIA ticks (~1 us); the last bin also holds anything slower. Latencies
+ * include retries.
+ */
+struct mega65_sdcard_stats {
+    uint32_t reads;    //!< Sector reads, including submitted ones
+    uint32_t writes;   //!< Sector writes, including submitted ones
+    uint16_t retries;  //!< Commands repeated after a failure
+    uint16_t timeouts; //!< Waits for the card that timed out
+    uint16_t resets;   //!< Card resets
+    uint16_t errors;   //!< Reads and writes that failed
+    uint16_t read_latency[SDCARD_LATENCY_BINS];  //!< Read latency histogram
+    uint16_t write_latency[SDCARD_LATENCY_BINS]; //!< Write latency histogram
+};
+
+/// Returned by `mega65_sdcard_poll()` while a command is in progress
+#define SDCARD_ASYNC_BUSY 0x01
+/// Returned by `mega65_sdcard_poll()` when no command has been submitted
+#define SDCARD_ASYNC_IDLE 0x02
+
+/**
+ * @brief Completion callback for asynchronous commands
+ * @param result 0 on success, 0xff on error
+ */
+typedef void (*mega65_sdcard_callback)(uint8_t result);
+
+/**
+ * @brief Counters updated by `mega65_sdcard_writesector()`
+ */
+struct mega65_sdcard_write_stats {
+    uint32_t written;       //!< Sectors sent to the card, including retries
+    uint32_t skipped;       //!< Writes skipped as the sector was identical
+    uint32_t verify_errors; //!< Read-backs that did not match
+};
+
 #ifdef __cplusplus
 // Being compiled by a C++ compiler, inhibit name mangling
 extern "C" {
 #endif
 
 extern uint8_t sector_buffer[512];
+extern struct mega65_sdcard_write_stats sdcard_write_stats;
+extern struct mega65_sdcard_stats sdcard_stats;
+
+/**
+ * @brief Clear `sdcard_stats` and start the timer used for latencies
+ *
+ * Latencies are measured with `hal_timer_ticks()`, so they are only
+ * meaningful after this has been called.
+ */
+void mega65_sdcard_stats_reset(void);
+
+/**
+ * @brief Write `sdcard_stats` and `sdcard_write_stats` to the serial monitor
+ */
+void mega65_sdcard_stats_dump(void);
 
 void mega65_clear_sector_buffer(void);
 void mega65_sdcard_reset(void);
 void mega65_fast(void);
 void mega65_sdcard_open(void);
+
+/**
+ * @brief Size of the SD card
+ * @return Number of readable sectors, or 0 if the card cannot be read
+ *
+ * Also detects whether the card is SDHC. The card is probed on the first
+ * call only; later calls return the cached result.
+ */
+uint32_t mega65_sdcard_getsize(void);
 void mega65_sdcard_map_sector_buffer(void);
 void mega65_sdcard_unmap_sector_buffer(void);
 uint8_t mega65_sdcard_readsector(const uint32_t sector_number);
+
+/**
+ * @brief Enable read-ahead for `mega65_sdcard_readsector()`
+ * @param depth Number of sectors to prefetch, at most `SDCARD_READAHEAD_MAX`;
+ * 0 disables read-ahead
+ * @return 1 on success, 0 if the ring buffer could not be allocated
+ *
+ * When sectors are read one after the other, the following sectors are read
+ * in the background into a ring of buffers allocated with `lmalloc()`, so
+ * that the next call only copies the data. The ring advances on each call
+ * of `mega65_sdcard_readsector()`; calling `mega65_sdcard_poll()` from the
+ * main loop keeps it filling while the program works on the data. The ring
+ * is not protected against interrupts, so while read-ahead is enabled only
+ * the main program may call `mega65_sdcard_poll()`, and no asynchronous
+ * commands may be submitted.
+ */
+uint8_t mega65_sdcard_readahead(const uint8_t depth);
+
+/**
+ * @brief Read consecutive sectors into far memory
+ * @param first_sector First sector to read
+ * @param count Number of sectors to read
+ * @param destination 28-bit address to read to; `count * 512` bytes
+ * @return 0 on success, 0xff on error
+ *
+ * Each sector is copied by DMA straight from the SD card buffer to its
+ * destination, bypassing `sector_buffer`.
+ */
+uint8_t mega65_sdcard_readsectors(
+    uint32_t first_sector, uint16_t count, uint32_t destination);
+/**
+ * @brief Read a sector and access it in place in the SD card buffer
+ * @param sector_number Sector to read
+ * @return Pointer to the sector mapped at $DE00, or NULL on error
+ *
+ * Nothing is copied: the data stays in the controller's buffer, which is
+ * mapped into the I/O area until `mega65_sdcard_release()`. This suits
+ * parsers that only look at a few fields, e.g. directory or FAT entries.
+ * The pointer becomes invalid on release and on any other SD card access.
+ * I/O must be visible at $D000-$DFFF.
+ */
+const uint8_t* mega65_sdcard_acquire(const uint32_t sector_number);
+
+/**
+ * @brief Unmap the SD card buffer mapped by `mega65_sdcard_acquire()`
+ */
+void mega65_sdcard_release(void);
+
 uint8_t mega65_sdcard_writesector(const uint32_t sector_number);
+
+/**
+ * @brief Write `sector_buffer` to a sector with a given write policy
+ * @param sector_number Sector to write
+ * @param policy Combination of `SDCARD_WRITE_*` flags
+ * @return 0 on success, 0xff on error
+ *
+ * Each of the checks in `SDCARD_WRITE_DEFAULT` costs time: skipping
+ * identical sectors needs a read first, and verification a read after the
+ * write. Bulk writers can trade these for throughput.
+ */
+uint8_t mega65_sdcard_writesector_policy(
+    const uint32_t sector_number, const uint8_t policy);
+
+/**
+ * @brief Set the write policy used by `mega65_sdcard_writesector()`
+ * @param policy Combination of `SDCARD_WRITE_*` flags
+ */
+void mega65_sdcard_set_write_policy(const uint8_t policy);
+
+/**
+ * @brief Write consecutive sectors from far memory
+ * @param first_sector First sector to write
+ * @param count Number of sectors to write
+ * @param source 28-bit address to write from; `count * 512` bytes
+ * @return 0 on success, 0xff on error
+ *
+ * Uses a single multi-block write, with each sector copied by DMA straight
+ * into the SD card buffer. Unlike `mega65_sdcard_writesector()`, sectors are
+ * not read back for verification.
+ */
+uint8_t mega65_sdcard_writesectors(
+    uint32_t first_sector, uint16_t count, uint32_t source);
+/**
+ * @brief Start reading a sector without waiting for it
+ * @param sector_number Sector to read
+ * @param destination 28-bit address to copy the sector to, or 0 to leave it
+ * in the SD card buffer
+ * @param callback Called on completion, or NULL
+ * @return 0 if submitted, 0xff if a command is already in progress
+ *
+ * Call `mega65_sdcard_poll()` regularly to drive the command, e.g. once per
+ * frame from the main loop or a raster interrupt. Until the command has
+ * completed, the blocking SD card functions fail and return 0xff, or 0 for
+ * `mega65_sdcard_getsize()`.
+ */
+uint8_t mega65_sdcard_submit_read(const uint32_t sector_number,
+    const uint32_t destination, const mega65_sdcard_callback callback);
+
+/**
+ * @brief Start writing a sector without waiting for it
+ * @param sector_number Sector to write
+ * @param source 28-bit address of the 512 bytes to write
+ * @param callback Called on completion, or NULL
+ * @return 0 if submitted, 0xff if a command is already in progress
+ *
+ * The data is not verified; see `mega65_sdcard_submit_read()`.
+ */
+uint8_t mega65_sdcard_submit_write(const uint32_t sector_number,
+    const uint32_t source, const mega65_sdcard_callback callback);
+
+/**
+ * @brief Advance a submitted command without blocking
+ * @return `SDCARD_ASYNC_BUSY` while in progress, then once 0 on success or
+ * 0xff on error, and `SDCARD_ASYNC_IDLE` afterwards
+ *
+ * The callback is run from within this function when the command completes
+ * and may submit the next command. Sector data is copied with the CPU rather
+ * than DMA, so this is safe to call from an interrupt handler, except while
+ * read-ahead is enabled; see `mega65_sdcard_readahead()`.
+ *
+ * A command still busy `SDCARD_ASYNC_TIMEOUT` ticks after it was submitted
+ * completes with 0xff and is counted in `sdcard_stats.timeouts`. This needs
+ * the timer started by `mega65_sdcard_stats_reset()` or `hal_timer_start()`.
+ */
+uint8_t mega65_sdcard_poll(void);
+
 void mega65_sdcard_erase(
     const uint32_t first_sector, const uint32_t last_sector);
 
@@ -1,9 +1,9 @@
-        .export _lpoke, _lpeek
+        .export _lpoke, _lpeek, _lcopy_cpu, _lfill_cpu
 
         .p02
 
-        .importzp sp,sreg,tmp1,tmp2,tmp3,tmp4
-        .import incsp4
+        .importzp sp,sreg,regsave,ptr1,tmp1,tmp2,tmp3,tmp4
+        .import incsp4,incsp5,incsp8
         sp4510 = sp
 
         .p4510
@@ -40,3 +40,48 @@
         lda (tmp1),z
         rts
 .endproc
+
+; void lcopy_cpu(uint32_t src, uint32_t dst, uint8_t count)
+.proc	_lcopy_cpu: near
+        sta regsave             ; count; 0 = 256 bytes
+        ldy #$03
+@dst:   lda (sp),y              ; dst -> tmp1-tmp4
+        sta tmp1,y
+        dey
+        bpl @dst
+        ldy #$07
+@src:   lda (sp),y              ; src -> ptr1-ptr2
+        sta ptr1-4,y
+        dey
+        cpy #$03
+        bne @src
+        ldz #$00
+@loop:  nop
+        lda (ptr1),z
+        nop
+        sta (tmp1),z
+        inz
+        cpz regsave
+        bne @loop
+        ldz #$00                ; leave Z cleared for (zp) addressing
+        jmp incsp8
+.endproc
+
+; void lfill_cpu(uint32_t dst, uint8_t value, uint8_t count)
+.proc	_lfill_cpu: near
+        sta regsave             ; count; 0 = 256 bytes
+        ldy #$04
+@dst:   lda (sp),y              ; dst -> tmp1-tmp4
+        sta tmp1-1,y
+        dey
+        bne @dst
+        lda (sp),y              ; value
+        ldz #$00
+@loop:  nop
+        sta (tmp1),z
+        inz
+        cpz regsave
+        bne @loop
+        ldz #$00
+        jmp incsp5
+.endproc
@@ -28,6 +28,9 @@
         | ((unsigned long)SCREEN_RAM_BASE_B0))
 #define COLOR_RAM_BASE 0xFF80000UL
 
+// Number of chained DMA jobs submitted at once by the 2D drawing routines
+#define CONIO_DMA_JOBS 8
+
 #define PRINTF_IN_FORMAT_SPEC 0x1
 #define PRINTF_FLAGS_LEADINGZERO 0x2
 #define PRINTF_STATE_INIT 0
@@ -52,6 +55,8 @@ static unsigned char g_curX = 0;
 static unsigned char g_curY = 0;
 static unsigned char g_curScreenW = 0;
 static unsigned char g_curScreenH = 0;
+static struct dmagic_dmalist g_dmaJobs[CONIO_DMA_JOBS];
+static struct dma_batch g_dmaBatch;
 static const unsigned char hexDigits[] = { '0', '1', '2', '3', '4', '5', '6',
     '7', '8', '9', 0x41, 0x42, 0x43, 0x44, 0x45, 0x46 };
 
@@ -597,22 +602,51 @@ void cputncxy(
     g_curX = (x + count) % g_curScreenW;
 }
 
-void fillrect(const RECT* rc, unsigned char ch, unsigned char col)
+// Queue the fill of a rectangle on g_dmaBatch; caller begins and submits
+static void fillrect_(const RECT* rc, unsigned char ch, unsigned char col)
 {
-    register unsigned char i = 0;
     const unsigned char len = rc->right - rc->left;
-    for (i = rc->top; i <= rc->bottom; ++i) {
-        const unsigned int offset = (i * (unsigned int)g_curScreenW) + rc->left;
-        lfill(SCREEN_RAM_BASE + offset, ch, len);
-        lfill(COLOR_RAM_BASE + offset, col, len);
-    }
+    const unsigned char rows = rc->bottom - rc->top + 1;
+    const unsigned int offset
+        = (rc->top * (unsigned int)g_curScreenW) + rc->left;
+    dma_batch_fill_rect(
+        &g_dmaBatch, SCREEN_RAM_BASE + offset, g_curScreenW, ch, len, rows, 1);
+    dma_batch_fill_rect(
+        &g_dmaBatch, COLOR_RAM_BASE + offset, g_curScreenW, col, len, rows, 1);
+}
+
+void fillrect(const RECT* rc, unsigned char ch, unsigned char col)
+{
+    dma_batch_begin(&g_dmaBatch, g_dmaJobs, CONIO_DMA_JOBS);
+    fillrect_(rc, ch, col);
+    dma_batch_submit(&g_dmaBatch);
+}
+
+// Queue a horizontal run of len characters on g_dmaBatch
+static void hrun_(unsigned char x, unsigned char y, unsigned char len,
+    unsigned char ch, unsigned char col)
+{
+    const unsigned int offset = (y * (unsigned int)g_curScreenW) + x;
+    dma_batch_fill(&g_dmaBatch, SCREEN_RAM_BASE + offset, ch, len);
+    dma_batch_fill(&g_dmaBatch, COLOR_RAM_BASE + offset, col, len);
+}
+
+// Queue a vertical run of len characters on g_dmaBatch
+static void vrun_(unsigned char x, unsigned char y, unsigned char len,
+    unsigned char ch, unsigned char col)
+{
+    const unsigned int offset = (y * (unsigned int)g_curScreenW) + x;
+    dma_batch_fill_skip(
+        &g_dmaBatch, SCREEN_RAM_BASE + offset, ch, len, g_curScreenW);
+    dma_batch_fill_skip(
+        &g_dmaBatch, COLOR_RAM_BASE + offset, col, len, g_curScreenW);
 }
 
 void box(const RECT* rc, unsigned char color, unsigned char style,
     unsigned char clear, unsigned char shadow)
 {
-    register unsigned char i = 0;
     const unsigned char len = rc->right - rc->left;
+    const unsigned char height = rc->bottom - rc->top;
     unsigned char prevCol = g_curTextColor;
 #ifndef __CC65__
     const unsigned char chTopLeft[] = { 0x20, 0x20, 0x70, 0x4F, 0x55 };
@@ -625,33 +659,43 @@ void box(const RECT* rc, unsigned char color, unsigned char style,
     const unsigned char chVertLeft[] = { 0x20, 0x6A, 0x5D, 0x74, 0x5D };
 #endif
     textcolor(color);
+
+    // Edges, interior and shadow go out as one chained DMA submission
+    dma_batch_begin(&g_dmaBatch, g_dmaJobs, CONIO_DMA_JOBS);
     if (clear) {
-        fillrect(rc, ' ', g_curTextColor);
+        fillrect_(rc, ' ', g_curTextColor);
     }
 
-    cputcxy(rc->left, rc->top, chTopLeft[style]);
-    cputcxy(rc->left, rc->bottom, chBottomLeft[style]);
-    cputcxy(rc->right, rc->top, chTopRight[style]);
-    cputcxy(rc->right, rc->bottom, chBottomRight[style]);
-
-    for (i = 1; i < len; ++i) {
-        cputcxy(rc->left + i, rc->top, chHorzTop[style]);
-        cputcxy(rc->left + i, rc->bottom, chHorzBottom[style]);
+    if (len > 1) {
+        hrun_(rc->left + 1, rc->top, len - 1, chHorzTop[style], g_curTextColor);
+        hrun_(rc->left + 1, rc->bottom, len - 1, chHorzBottom[style],
+            g_curTextColor);
     }
 
-    for (i = rc->top + 1; i <= rc->bottom - 1; ++i) {
-        cputcxy(rc->left, i, chVertLeft[style]);
-        cputcxy(rc->right, i, chVertRight[style]);
+    if (height > 1) {
+        vrun_(rc->left, rc->top + 1, height - 1, chVertLeft[style],
+            g_curTextColor);
+        vrun_(rc->right, rc->top + 1, height - 1, chVertRight[style],
+            g_curTextColor);
     }
 
     if (shadow && rc->bottom < g_curScreenH && rc->right < g_curScreenW) {
-        lfill(COLOR_RAM_BASE + ((rc->bottom + 1) * (unsigned int)g_curScreenW)
-                  + (1 + rc->left),
+        dma_batch_fill(&g_dmaBatch,
+            COLOR_RAM_BASE + ((rc->bottom + 1) * (unsigned int)g_curScreenW)
+                + (1 + rc->left),
             COLOUR_DARKGREY, len);
-        for (i = rc->top + 1; i <= rc->bottom + 1; ++i) {
-            cellcolor(rc->right + 1, i, COLOUR_DARKGREY);
-        }
+        dma_batch_fill_skip(&g_dmaBatch,
+            COLOR_RAM_BASE + ((rc->top + 1) * (unsigned int)g_curScreenW)
+                + (rc->right + 1),
+            COLOUR_DARKGREY, height + 1, g_curScreenW);
     }
+    dma_batch_submit(&g_dmaBatch);
+
+    cputcxy(rc->left, rc->top, chTopLeft[style]);
+    cputcxy(rc->left, rc->bottom, chBottomLeft[style]);
+    cputcxy(rc->right, rc->top, chTopRight[style]);
+    cputcxy(rc->right, rc->bottom, chBottomRight[style]);
+
     textcolor(prevCol);
 }
 
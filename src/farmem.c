@@ -0,0 +1,285 @@
+#include <mega65/farmem.h>
+#include <mega65/memory.h>
+
+#define NIL 0xff
+#define SIZE_CLASSES 16 // log2 of the block size in units
+#define MAX_SIZE 0xffff00UL
+
+#define BLOCK_UNUSED 0
+#define BLOCK_FREE 1
+#define BLOCK_USED 2
+
+struct farmem_block {
+    uint16_t start;    // first 256 byte unit relative to the region
+    uint16_t units;    // length in 256 byte units
+    uint8_t region;    // index into region_base
+    uint8_t flags;     // BLOCK_UNUSED, BLOCK_FREE or BLOCK_USED
+    uint8_t prev;      // neighbours in address order
+    uint8_t next;      //
+    uint8_t prev_free; // size-class list (free) or spare slot list (unused)
+    uint8_t next_free; //
+};
+
+static struct farmem_block blocks[FARMEM_BLOCKS];
+static uint32_t region_base[FARMEM_REGIONS];
+static uint8_t free_list[SIZE_CLASSES];
+static uint8_t region_count;
+static uint8_t unused_list;
+static uint8_t initialised;
+
+static uint8_t size_class(uint16_t units)
+{
+    uint8_t c = 0;
+    while (units >>= 1) {
+        ++c;
+    }
+    return c;
+}
+
+static uint32_t block_address(const uint8_t b)
+{
+    return region_base[blocks[b].region] + ((uint32_t)blocks[b].start << 8);
+}
+
+static void free_list_push(const uint8_t b)
+{
+    const uint8_t c = size_class(blocks[b].units);
+    blocks[b].flags = BLOCK_FREE;
+    blocks[b].prev_free = NIL;
+    blocks[b].next_free = free_list[c];
+    if (free_list[c] != NIL) {
+        blocks[free_list[c]].prev_free = b;
+    }
+    free_list[c] = b;
+}
+
+static void free_list_unlink(const uint8_t b)
+{
+    if (blocks[b].prev_free != NIL) {
+        blocks[blocks[b].prev_free].next_free = blocks[b].next_free;
+    }
+    else {
+        free_list[size_class(blocks[b].units)] = blocks[b].next_free;
+    }
+    if (blocks[b].next_free != NIL) {
+        blocks[blocks[b].next_free].prev_free = blocks[b].prev_free;
+    }
+}
+
+static uint8_t slot_take(void)
+{
+    const uint8_t b = unused_list;
+    if (b != NIL) {
+        unused_list = blocks[b].next_free;
+    }
+    return b;
+}
+
+static void slot_release(const uint8_t b)
+{
+    blocks[b].flags = BLOCK_UNUSED;
+    blocks[b].next_free = unused_list;
+    unused_list = b;
+}
+
+// Absorb the block following b, which must not be in any list
+static void block_absorb_next(const uint8_t b)
+{
+    const uint8_t n = blocks[b].next;
+    blocks[b].units += blocks[n].units;
+    blocks[b].next = blocks[n].next;
+    if (blocks[n].next != NIL) {
+        blocks[blocks[n].next].prev = b;
+    }
+    slot_release(n);
+}
+
+// Put b on a free list, merging it with free neighbours first
+static void block_free(uint8_t b)
+{
+    const uint8_t n = blocks[b].next;
+    const uint8_t p = blocks[b].prev;
+
+    if (n != NIL && blocks[n].flags == BLOCK_FREE) {
+        free_list_unlink(n);
+        block_absorb_next(b);
+    }
+    if (p != NIL && blocks[p].flags == BLOCK_FREE) {
+        free_list_unlink(p);
+        block_absorb_next(p);
+        b = p;
+    }
+    free_list_push(b);
+}
+
+// Shrink b to the given number of units and release the tail. If the block
+// table is full, b keeps its tail.
+static void block_split(const uint8_t b, const uint16_t units)
+{
+    uint8_t r;
+
+    if (blocks[b].units == units || (r = slot_take()) == NIL) {
+        return;
+    }
+    blocks[r].start = blocks[b].start + units;
+    blocks[r].units = blocks[b].units - units;
+    blocks[r].region = blocks[b].region;
+    blocks[r].prev = b;
+    blocks[r].next = blocks[b].next;
+    if (blocks[b].next != NIL) {
+        blocks[blocks[b].next].prev = r;
+    }
+    blocks[b].next = r;
+    blocks[b].units = units;
+    block_free(r);
+}
+
+static uint8_t find_used(const uint32_t address)
+{
+    uint8_t b;
+    for (b = 0; b < FARMEM_BLOCKS; ++b) {
+        if (blocks[b].flags == BLOCK_USED && block_address(b) == address) {
+            return b;
+        }
+    }
+    return NIL;
+}
+
+// Copy with DMA without letting a job cross a 64 kB bank boundary
+static void farmem_copy(uint32_t source, uint32_t destination, uint32_t count)
+{
+    uint32_t chunk;
+
+    while (count) {
+        chunk = 0x10000UL - (source & 0xffff);
+        if (chunk > 0x10000UL - (destination & 0xffff)) {
+            chunk = 0x10000UL - (destination & 0xffff);
+        }
+        if (chunk > count) {
+            chunk = count;
+        }
+        lcopy(source, destination, (size_t)chunk);
+        source += chunk;
+        destination += chunk;
+        count -= chunk;
+    }
+}
+
+void lmalloc_init(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < SIZE_CLASSES; ++i) {
+        free_list[i] = NIL;
+    }
+    unused_list = NIL;
+    for (i = FARMEM_BLOCKS; i > 0; --i) {
+        slot_release(i - 1);
+    }
+    region_count = 0;
+    initialised = 1;
+}
+
+uint8_t lmalloc_add(uint32_t start, uint32_t size)
+{
+    const uint32_t aligned = (start + 0xff) & ~0xffUL;
+    uint8_t b;
+
+    if (!initialised) {
+        lmalloc_init();
+    }
+    if (size < aligned - start) {
+        return 0;
+    }
+    size = (size - (aligned - start)) >> 8;
+    if (size > 0xffff) {
+        size = 0xffff;
+    }
+    if (!size || region_count == FARMEM_REGIONS || (b = slot_take()) == NIL) {
+        return 0;
+    }
+    region_base[region_count] = aligned;
+    blocks[b].start = 0;
+    blocks[b].units = (uint16_t)size;
+    blocks[b].region = region_count++;
+    blocks[b].prev = NIL;
+    blocks[b].next = NIL;
+    free_list_push(b);
+    return 1;
+}
+
+uint32_t lmalloc(uint32_t size)
+{
+    uint16_t units;
+    uint8_t c, b;
+
+    if (!size || size > MAX_SIZE) {
+        return 0;
+    }
+    if (!region_count) {
+        lmalloc_add(FARMEM_CHIP_BASE, FARMEM_CHIP_SIZE);
+    }
+    units = (uint16_t)((size + 0xff) >> 8);
+
+    // First fit within the request's class; any block in a larger class fits
+    for (c = size_class(units); c < SIZE_CLASSES; ++c) {
+        for (b = free_list[c]; b != NIL; b = blocks[b].next_free) {
+            if (blocks[b].units >= units) {
+                free_list_unlink(b);
+                blocks[b].flags = BLOCK_USED;
+                block_split(b, units);
+                return block_address(b);
+            }
+        }
+    }
+    return 0;
+}
+
+void lfree(uint32_t address)
+{
+    uint8_t b;
+
+    if (!address || (b = find_used(address)) == NIL) {
+        return;
+    }
+    block_free(b);
+}
+
+uint32_t lrealloc(uint32_t address, uint32_t size)
+{
+    uint32_t moved;
+    uint16_t units;
+    uint8_t b, n;
+
+    if (!address) {
+        return lmalloc(size);
+    }
+    if (!size) {
+        lfree(address);
+        return 0;
+    }
+    if (size > MAX_SIZE || (b = find_used(address)) == NIL) {
+        return 0;
+    }
+    units = (uint16_t)((size + 0xff) >> 8);
+
+    if (units <= blocks[b].units) {
+        block_split(b, units);
+        return address;
+    }
+    n = blocks[b].next;
+    if (n != NIL && blocks[n].flags == BLOCK_FREE
+        && (uint32_t)blocks[b].units + blocks[n].units >= units) {
+        free_list_unlink(n);
+        block_absorb_next(b);
+        block_split(b, units);
+        return address;
+    }
+
+    moved = lmalloc(size);
+    if (moved) {
+        farmem_copy(address, moved, (uint32_t)blocks[b].units << 8);
+        block_free(b);
+    }
+    return moved;
+}
@@ -1,121 +1,1258 @@
+#include <mega65/fat32.h>
 #include <mega65/sdcard.h>
+#include <mega65/sdcache.h>
 #include <mega65/hal.h>
 #include <mega65/memory.h>
+#include <mega65/farmem.h>
 #include <stdio.h>
 #include <string.h>
 
-/*
-  Create a file in the root directory of the new FAT32 filesystem
-  with the indicated name and size.
+#define FAT32_ERROR 0xff
+#define NO_SECTOR 0xffffffffUL
+#define END_OF_CHAIN 0x0fffffffUL
+#define CLUSTER_MASK 0x0fffffffUL
+#define MAX_TRANSFER 0x8000 // sectors per mega65_sdcard_readsectors() call
 
-  The file will be created contiguous on disk, and the first
-  sector of the created file returned.
+#define ATTR_VOLUME 0x08
+#define ATTR_LFN 0x0f
+#define DELETED 0xe5
 
-  The root directory is the start of cluster 2, and clusters are
-  assumed to be 4KB in size, to keep things simple.
+#define LFN_NONE 0
+#define LFN_COMPLETE 0xff
 
-  Returns first sector of file if successful, or 0xffffffff on failure.
-*/
-unsigned long mega65_fat32_create_contiguous_file(char* name, unsigned long size,
-    unsigned long root_dir_sector, unsigned long fat1_sector, unsigned long fat2_sector)
+#define EXTENT_GROWTH 64 // free list records added at a time
+#define EXTENT_MAX 0x1fc0
+#define FAT_BATCH 16 // FAT sectors per multi-sector write
+#define RUN_GROWTH 32  // file run list records added at a time
+#define RUN_MAX 0x1fe0
+#define DIR_END 1
+
+#define INDEX_BUCKETS 16   // must be a power of two
+#define INDEX_GROWTH 8     // directory index records added at a time
+#define INDEX_RECORDS_MAX 0x7f8
+#define NAMES_GROWTH 256   // long name bytes added at a time
+#define NAMES_MAX 0xff00
+#define INDEX_NIL 0xffff
+#define RECORD_LFN 0x80    // in attributes: the hash is of the long name
+
+static uint32_t fat_begin;     // first sector of the first FAT
+static uint32_t fat_sectors;   // sectors per FAT
+static uint32_t data_begin;    // first sector of cluster 2
+static uint32_t root_cluster;  // first cluster of the root directory
+static uint32_t cluster_count; // number of data clusters
+static uint8_t fat_copies;     // number of FATs
+static uint8_t cluster_shift;  // log2 of the sectors per cluster
+static uint8_t mounted;
+
+// Sector currently in sector_buffer, so that runs of FAT lookups in the same
+// sector are not read again. Reset on entry to each public function, as the
+// caller may have used the buffer in between.
+static uint32_t loaded_sector = NO_SECTOR;
+
+// Long file name being collected from the entries before a short entry
+static char lfn[MEGA65_FAT32_NAME_MAX + 1];
+static uint8_t lfn_state; // next expected ordinal, LFN_NONE or LFN_COMPLETE
+static uint8_t lfn_checksum;
+static char short_name[13];
+
+// Runs of free clusters, sorted by cluster apart from runs given back, built
+// on the first allocation after mounting. Records are never removed while
+// mounted; a used up run keeps a count of 0.
+struct free_extent {
+    uint32_t start; // first free cluster
+    uint32_t count; // number of free clusters
+};
+
+static uint32_t free_extents; // far memory array of struct free_extent
+static uint16_t free_extent_count;
+static uint16_t free_extent_capacity;
+static uint32_t free_clusters;
+static uint8_t free_extents_built; // list is that of the mounted volume
+static struct free_extent extent;
+
+// Record in the run list of a file. The runs are followed by a record with
+// the number of clusters in the file, so that the length of a run is the
+// difference of the index of the next record and its own.
+struct file_run {
+    uint32_t index;   // cluster number within the file
+    uint32_t cluster; // its cluster on the volume
+};
+
+static struct file_run runs[2];
+
+// Directory index record, 32 bytes so that none crosses a 64 kB boundary
+struct index_record {
+    uint32_t hash;          // of the upper case name
+    uint32_t first_cluster; //
+    uint32_t size;          //
+    uint32_t sector;        // location of the directory entry
+    uint16_t offset;        //
+    uint16_t next;          // next record in the same bucket
+    uint8_t attributes;     // with RECORD_LFN
+    uint8_t name[11];       // 8.3 name; for RECORD_LFN the offset (2 bytes)
+                            // and length of the long name in the name pool
+};
+
+// Name index of a directory, with its records in far memory
+struct dir_index {
+    uint32_t cluster; // first cluster of the directory, 0 if unused
+    uint32_t records; // far memory array of struct index_record
+    uint32_t names;   // far memory pool of the long names
+    uint16_t count;
+    uint16_t capacity;
+    uint16_t names_used;
+    uint16_t names_capacity;
+    uint16_t used; // clock of last use, for LRU
+    uint16_t bucket[INDEX_BUCKETS];
+};
+
+static struct dir_index indexes[MEGA65_FAT32_INDEX_DIRS];
+static struct dir_index* index_building;
+static struct index_record record;
+static uint16_t index_clock;
+
+// State of the directory walk for the visitors
+static uint32_t entry_sector;
+static const char* find_name;
+static uint8_t find_length;
+static struct mega65_fat32_file* find_file;
+
+// Offsets of the 13 UCS-2 characters in a long file name entry
+static const uint8_t lfn_chars[13]
+    = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+static uint16_t get16(const uint16_t offset)
 {
-    unsigned char i;
-    unsigned short offset;
-    unsigned short clusters;
-    unsigned long start_cluster = 0;
-    unsigned long next_cluster;
-    unsigned long contiguous_clusters = 0;
-    unsigned int fat_offset = 0;
-    int j;
-
-    clusters = (unsigned short)(size / 4096);
-    if (size & 4095) {
-        clusters++;
-    }
-
-    for (fat_offset = 0; fat_offset <= (fat2_sector - fat1_sector);
-         fat_offset++) {
-        mega65_sdcard_readsector((uint32_t)(fat1_sector + fat_offset));
-        contiguous_clusters = 0;
-        start_cluster = 0;
-
-        // Skip any FAT sectors with allocated clusters
-        for (j = 0; j < 512; j++) {
-            if (sector_buffer[j]) {
-                break;
+    return sector_buffer[offset] | ((uint16_t)sector_buffer[offset + 1] << 8);
+}
+
+static uint32_t get32(const uint16_t offset)
+{
+    return get16(offset) | ((uint32_t)get16(offset + 2) << 16);
+}
+
+static void put32(const uint16_t offset, const uint32_t value)
+{
+    sector_buffer[offset] = (uint8_t)value;
+    sector_buffer[offset + 1] = (uint8_t)(value >> 8);
+    sector_buffer[offset + 2] = (uint8_t)(value >> 16);
+    sector_buffer[offset + 3] = (uint8_t)(value >> 24);
+}
+
+static uint8_t fat32_load(const uint32_t sector)
+{
+    if (sector == loaded_sector) {
+        return 0;
+    }
+    loaded_sector = NO_SECTOR;
+    if (sdcache_read(sector)) {
+        return FAT32_ERROR;
+    }
+    loaded_sector = sector;
+    return 0;
+}
+
+static uint32_t cluster_sector(const uint32_t cluster)
+{
+    return data_begin + ((cluster - 2) << cluster_shift);
+}
+
+// Next cluster of a chain, or END_OF_CHAIN at its end or on error
+static uint32_t fat32_next(const uint32_t cluster)
+{
+    uint32_t next;
+
+    if (fat32_load(fat_begin + (cluster >> 7))) {
+        return END_OF_CHAIN;
+    }
+    next = get32((uint16_t)(cluster & 0x7f) << 2) & CLUSTER_MASK;
+    if (next < 2 || next >= cluster_count + 2) {
+        return END_OF_CHAIN;
+    }
+    return next;
+}
+
+// ASCII only; PETSCII letters are left alone
+static char fat32_upper(const char c)
+{
+    return (c >= 0x61 && c <= 0x7a) ? c - 0x20 : c;
+}
+
+static uint8_t short_name_checksum(const uint8_t* entry)
+{
+    uint8_t sum = 0;
+    uint8_t i;
+
+    for (i = 0; i < 11; ++i) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + entry[i];
+    }
+    return sum;
+}
+
+// Format the 8.3 name of an entry as e.g. "CHARROM.M65"
+static void short_name_format(const uint8_t* entry)
+{
+    uint8_t i;
+    uint8_t n = 0;
+
+    for (i = 0; i < 8 && entry[i] != ' '; ++i) {
+        short_name[n++] = entry[i];
+    }
+    if (short_name[0] == 0x05) {
+        short_name[0] = DELETED;
+    }
+    if (entry[8] != ' ') {
+        short_name[n++] = '.';
+        for (i = 8; i < 11 && entry[i] != ' '; ++i) {
+            short_name[n++] = entry[i];
+        }
+    }
+    short_name[n] = 0;
+}
+
+// Add a long file name entry to lfn. The entries of a name come in reverse
+// order, the last part first.
+static void lfn_collect(const uint8_t* entry)
+{
+    const uint8_t ordinal = entry[0] & 0x1f;
+    const uint8_t* c;
+    uint8_t position;
+    uint8_t i;
+
+    // A long name has at most 20 entries of 13 characters; larger ordinals
+    // would also wrap the 8-bit position below
+    if (!ordinal || ordinal > 20) {
+        lfn_state = LFN_NONE;
+        return;
+    }
+    position = (uint8_t)((ordinal - 1) * 13);
+    if (entry[0] & 0x40) {
+        lfn_checksum = entry[13];
+        lfn_state = ordinal;
+        if (position + 13 <= MEGA65_FAT32_NAME_MAX) {
+            lfn[position + 13] = 0;
+        }
+    }
+    if (ordinal != lfn_state || entry[13] != lfn_checksum
+        || position + 13 > MEGA65_FAT32_NAME_MAX) {
+        lfn_state = LFN_NONE;
+        return;
+    }
+    for (i = 0; i < 13; ++i) {
+        c = entry + lfn_chars[i];
+        if (c[1]) {
+            if (c[0] == 0xff && c[1] == 0xff) {
+                break; // padding after the end of the name
             }
+            lfn_state = LFN_NONE; // not ASCII, so cannot be matched
+            return;
         }
-        if (j != 512) {
-            continue;
+        lfn[position + i] = fat32_upper(c[0]);
+        if (!c[0]) {
+            break;
         }
+    }
+    // An empty long name cannot be matched and would give a 0 byte copy,
+    // which DMA takes as 64 kB
+    if (ordinal == 1) {
+        lfn_state = lfn[0] ? LFN_COMPLETE : LFN_NONE;
+        return;
+    }
+    lfn_state = ordinal - 1;
+}
+
+// Compare a path component with an upper case name
+static uint8_t name_matches(
+    const char* name, const uint8_t length, const char* candidate)
+{
+    uint8_t i;
+
+    for (i = 0; i < length; ++i) {
+        if (fat32_upper(name[i]) != candidate[i]) {
+            return 0;
+        }
+    }
+    return !candidate[length];
+}
+
+static void fat32_rewind(struct mega65_fat32_file* file)
+{
+    file->position = 0;
+    file->cluster = file->first_cluster;
+    file->cluster_index = 0;
+}
 
-        for (offset = 0; offset < 512; offset += 4) {
-            next_cluster = sector_buffer[offset];
-            next_cluster |= ((unsigned long)sector_buffer[offset + 1] << 8L);
-            next_cluster |= ((unsigned long)sector_buffer[offset + 2] << 16L);
-            next_cluster |= ((unsigned long)sector_buffer[offset + 3] << 24L);
-            if (!next_cluster) {
-                if (!start_cluster) {
-                    start_cluster = (offset / 4) + fat_offset * (512 / 4);
+// Called by fat32_dir_walk() for each file and directory, with the entry in
+// sector_buffer; returns 1 to stop the walk
+typedef uint8_t (*dir_visitor)(const uint16_t offset);
+
+static uint8_t fat32_dir_walk(uint32_t cluster, const dir_visitor visit)
+{
+    const uint8_t* entry;
+    uint16_t offset;
+    uint8_t sector;
+
+    lfn_state = LFN_NONE;
+    while (cluster != END_OF_CHAIN) {
+        for (sector = 0; sector < (uint8_t)(1 << cluster_shift); ++sector) {
+            entry_sector = cluster_sector(cluster) + sector;
+            if (fat32_load(entry_sector)) {
+                return FAT32_ERROR;
+            }
+            for (offset = 0; offset < 512; offset += 32) {
+                entry = sector_buffer + offset;
+                if (!entry[0]) {
+                    return DIR_END;
                 }
-                contiguous_clusters++;
-                if (contiguous_clusters == clusters) {
-                    // End of chain marker
-                    sector_buffer[offset + 0] = 0xff;
-                    sector_buffer[offset + 1] = 0xff;
-                    sector_buffer[offset + 2] = 0xff;
-                    sector_buffer[offset + 3] = 0x0f;
-                    break;
+                if (entry[0] == DELETED) {
+                    lfn_state = LFN_NONE;
+                    continue;
                 }
-                else {
-                    // Point to next cluster
-                    uint32_t the_cluster
-                        = (fat_offset * (512 / 4) + (offset / 4)) + 1;
-                    sector_buffer[offset + 0] = (the_cluster >> 0) & 0xff;
-                    sector_buffer[offset + 1] = (the_cluster >> 8) & 0xff;
-                    sector_buffer[offset + 2] = (the_cluster >> 16) & 0xff;
-                    sector_buffer[offset + 3] = (the_cluster >> 24) & 0xff;
+                if (entry[11] == ATTR_LFN) {
+                    lfn_collect(entry);
+                    continue;
                 }
-            }
-            else {
-                if (start_cluster) {
-                    // write_line("ERROR: Disk space is fragmented. File not
-                    // created.",0); 	    return 0; Not enough contiguous
-                    // space in this FAT sector, so try the next
-                    break;
+                if (!(entry[11] & ATTR_VOLUME)) {
+                    if (lfn_state == LFN_COMPLETE
+                        && lfn_checksum != short_name_checksum(entry)) {
+                        lfn_state = LFN_NONE;
+                    }
+                    short_name_format(entry);
+                    if (visit(offset)) {
+                        return 0;
+                    }
                 }
+                lfn_state = LFN_NONE;
             }
         }
+        cluster = fat32_next(cluster);
+    }
+    return DIR_END;
+}
+
+static void fat32_entry_fill(
+    struct mega65_fat32_file* file, const uint16_t offset)
+{
+    file->first_cluster
+        = get16(offset + 0x1a) | ((uint32_t)get16(offset + 0x14) << 16);
+    file->size = get32(offset + 0x1c);
+    file->attributes = sector_buffer[offset + 11];
+    file->entry_sector = entry_sector;
+    file->entry_offset = offset;
+}
+
+static uint8_t find_visit(const uint16_t offset)
+{
+    if ((lfn_state == LFN_COMPLETE
+            && name_matches(find_name, find_length, lfn))
+        || name_matches(find_name, find_length, short_name)) {
+        fat32_entry_fill(find_file, offset);
+        return 1;
+    }
+    return 0;
+}
+
+// Look up a name in a directory by reading all of its entries
+static uint8_t fat32_find(const uint32_t cluster, const char* name,
+    const uint8_t length, struct mega65_fat32_file* file)
+{
+    find_name = name;
+    find_length = length;
+    find_file = file;
+    return fat32_dir_walk(cluster, find_visit) ? FAT32_ERROR : 0;
+}
+
+static uint32_t name_hash(const char* name, const uint8_t length)
+{
+    uint32_t hash = 5381;
+    uint8_t i;
+
+    for (i = 0; i < length; ++i) {
+        hash = (hash << 5) + hash + (uint8_t)fat32_upper(name[i]);
+    }
+    return hash;
+}
+
+static void index_drop(struct dir_index* index)
+{
+    lfree(index->records);
+    lfree(index->names);
+    index->records = 0;
+    index->names = 0;
+    index->cluster = 0;
+}
+
+// Copy a long name to the name pool and note its place in record. A name is
+// kept within one 256-byte page of the pool, so it never crosses a 64 kB
+// boundary wherever lrealloc() moves the pool.
+static uint8_t index_name_add(const char* name, const uint8_t length)
+{
+    struct dir_index* index = index_building;
+    uint16_t at = index->names_used;
+    uint32_t grown;
+
+    if ((uint8_t)at && (uint8_t)at + length > 256) {
+        at = (at + 255) & 0xff00;
+    }
+    if (at + length > index->names_capacity) {
+        if (index->names_capacity == NAMES_MAX
+            || !(grown = lrealloc(index->names,
+                     (uint32_t)index->names_capacity + NAMES_GROWTH))) {
+            return 1;
+        }
+        index->names = grown;
+        index->names_capacity += NAMES_GROWTH;
+    }
+    if (length) {
+        lcopy((uint32_t)name, index->names + at, length);
+    }
+    record.name[0] = (uint8_t)at;
+    record.name[1] = (uint8_t)(at >> 8);
+    record.name[2] = length;
+    index->names_used = at + length;
+    return 0;
+}
+
+// Compare a path component with the long name of record, from the name pool
+static uint8_t index_name_matches(const struct dir_index* index,
+    const char* name, const uint8_t length)
+{
+    const uint16_t at = record.name[0] | ((uint16_t)record.name[1] << 8);
+
+    if (record.name[2] != length) {
+        return 0;
+    }
+    // lfn is free outside directory walks
+    if (length) {
+        lcopy(index->names + at, (uint32_t)lfn, length);
+    }
+    lfn[length] = 0;
+    return name_matches(name, length, lfn);
+}
+
+static void index_drop_all(void)
+{
+    uint8_t i;
+
+    for (i = 0; i < MEGA65_FAT32_INDEX_DIRS; ++i) {
+        index_drop(&indexes[i]);
+    }
+}
+
+static uint8_t index_add(const char* name, const uint16_t offset,
+    const uint8_t flags)
+{
+    struct dir_index* index = index_building;
+    const uint8_t length = (uint8_t)strlen(name);
+    uint32_t grown;
+    uint8_t bucket;
+
+    if (index->count == index->capacity) {
+        if (index->capacity == INDEX_RECORDS_MAX
+            || !(grown = lrealloc(index->records,
+                     (uint32_t)(index->capacity + INDEX_GROWTH) << 5))) {
+            return 1;
+        }
+        index->records = grown;
+        index->capacity += INDEX_GROWTH;
+    }
+    record.hash = name_hash(name, length);
+    record.first_cluster
+        = get16(offset + 0x1a) | ((uint32_t)get16(offset + 0x14) << 16);
+    record.size = get32(offset + 0x1c);
+    record.sector = entry_sector;
+    record.offset = offset;
+    record.attributes = sector_buffer[offset + 11] | flags;
+    if (!flags) {
+        memcpy(record.name, sector_buffer + offset, 11);
+    }
+    else if (index_name_add(name, length)) {
+        return 1;
+    }
+    bucket = (uint8_t)record.hash & (INDEX_BUCKETS - 1);
+    record.next = index->bucket[bucket];
+    index->bucket[bucket] = index->count;
+    lcopy((uint32_t)&record, index->records + ((uint32_t)index->count << 5),
+        32);
+    ++index->count;
+    return 0;
+}
+
+// Add a record for the 8.3 name of an entry, and one for its long name
+static uint8_t index_visit(const uint16_t offset)
+{
+    return index_add(short_name, offset, 0)
+        || (lfn_state == LFN_COMPLETE && index_add(lfn, offset, RECORD_LFN));
+}
+
+// The index of a directory, built if there is none; NULL if it does not fit
+// into memory. The least recently used index is replaced.
+static struct dir_index* index_get(const uint32_t cluster)
+{
+    struct dir_index* index = indexes;
+    uint8_t i;
 
-        if (start_cluster && (contiguous_clusters == clusters)) {
+    for (i = 0; i < MEGA65_FAT32_INDEX_DIRS; ++i) {
+        if (indexes[i].cluster == cluster) {
+            index = &indexes[i];
             break;
         }
+        if (indexes[i].used < index->used) {
+            index = &indexes[i];
+        }
+    }
+    if (index->cluster != cluster) {
+        index_drop(index);
+        index->cluster = cluster;
+        index->count = 0;
+        index->capacity = 0;
+        index->names_used = 0;
+        index->names_capacity = 0;
+        for (i = 0; i < INDEX_BUCKETS; ++i) {
+            index->bucket[i] = INDEX_NIL;
+        }
+        index_building = index;
+        if (fat32_dir_walk(cluster, index_visit) != DIR_END) {
+            index_drop(index);
+            return 0;
+        }
+    }
+    if (!++index_clock) {
+        // Clock wrapped: restart the ordering
+        for (i = 0; i < MEGA65_FAT32_INDEX_DIRS; ++i) {
+            indexes[i].used = 0;
+        }
+        index_clock = 1;
+    }
+    index->used = index_clock;
+    return index;
+}
+
+// Look up a name in a directory through its index. Records with a matching
+// hash are confirmed against the full 8.3 or long name, so only a name that
+// is not in the index is reported as missing.
+static uint8_t fat32_lookup(const uint32_t cluster, const char* name,
+    const uint8_t length, struct mega65_fat32_file* file)
+{
+    const struct dir_index* index = index_get(cluster);
+    const uint32_t hash = name_hash(name, length);
+    uint16_t r;
+
+    if (!index) {
+        return fat32_find(cluster, name, length, file);
+    }
+    for (r = index->bucket[(uint8_t)hash & (INDEX_BUCKETS - 1)]; r != INDEX_NIL;
+         r = record.next) {
+        lcopy(index->records + ((uint32_t)r << 5), (uint32_t)&record, 32);
+        if (record.hash != hash) {
+            continue;
+        }
+        if (record.attributes & RECORD_LFN) {
+            if (!index_name_matches(index, name, length)) {
+                continue;
+            }
+        }
         else {
+            short_name_format(record.name);
+            if (!name_matches(name, length, short_name)) {
+                continue;
+            }
         }
+        file->first_cluster = record.first_cluster;
+        file->size = record.size;
+        file->attributes = record.attributes & ~RECORD_LFN;
+        file->entry_sector = record.sector;
+        file->entry_offset = record.offset;
+        return 0;
     }
-    if ((!start_cluster) || (contiguous_clusters != clusters)) {
-        //    write_line("ERROR: Could not find enough free clusters in file
-        //    system",0);
-        return 0xffffffffUL;
+    return FAT32_ERROR;
+}
+
+// Move file->cluster to cluster number index of the file by following the
+// chain. Used when the file has no run list.
+static uint8_t fat32_locate(
+    struct mega65_fat32_file* file, const uint32_t index)
+{
+    if (index < file->cluster_index) {
+        file->cluster = file->first_cluster;
+        file->cluster_index = 0;
     }
+    while (file->cluster_index < index) {
+        file->cluster = fat32_next(file->cluster);
+        if (file->cluster == END_OF_CHAIN) {
+            file->cluster = file->first_cluster;
+            file->cluster_index = 0;
+            return FAT32_ERROR;
+        }
+        ++file->cluster_index;
+    }
+    return 0;
+}
+
+static uint32_t run_address(
+    const struct mega65_fat32_file* file, const uint16_t run)
+{
+    return file->runs + ((uint32_t)run << 3);
+}
+
+// Append a run starting at cluster number index of the file to its list
+static uint8_t fat32_map_append(struct mega65_fat32_file* file,
+    uint16_t* capacity, const uint32_t index, const uint32_t cluster)
+{
+    uint32_t grown;
+
+    if (file->run_count == *capacity) {
+        if (*capacity == RUN_MAX
+            || !(grown = lrealloc(file->runs,
+                     (uint32_t)(*capacity + RUN_GROWTH) << 3))) {
+            return FAT32_ERROR;
+        }
+        file->runs = grown;
+        *capacity += RUN_GROWTH;
+    }
+    runs[0].index = index;
+    runs[0].cluster = cluster;
+    lcopy((uint32_t)&runs[0], run_address(file, file->run_count++), 8);
+    return 0;
+}
 
-    // Commit sector to disk (in both copies of FAT)
-    mega65_sdcard_writesector(fat1_sector + fat_offset);
-    mega65_sdcard_writesector(fat2_sector + fat_offset);
+// Follow the chain of a file once and record its runs of consecutive
+// clusters, ending with a run of no clusters after the last cluster. If
+// the list does not fit into memory, the file is read by following the
+// chain instead.
+static void fat32_map(struct mega65_fat32_file* file)
+{
+    const uint32_t clusters
+        = (file->size + (512UL << cluster_shift) - 1) >> (cluster_shift + 9);
+    uint32_t cluster = file->first_cluster;
+    uint32_t previous = 0;
+    uint32_t index;
+    uint16_t capacity = 0;
 
-    mega65_sdcard_readsector(root_dir_sector);
+    file->runs = 0;
+    file->run_count = 0;
+    file->run = 0;
+    if (cluster < 2 || cluster >= cluster_count + 2) {
+        cluster = END_OF_CHAIN;
+    }
+    for (index = 0; index < clusters && cluster != END_OF_CHAIN; ++index) {
+        if (cluster != previous + 1
+            && fat32_map_append(file, &capacity, index, cluster)) {
+            goto failed;
+        }
+        previous = cluster;
+        cluster = fat32_next(cluster);
+    }
+    if (!fat32_map_append(file, &capacity, index, 0)) {
+        --file->run_count; // the end marker is not a run
+        return;
+    }
+failed:
+    lfree(file->runs);
+    file->runs = 0;
+    file->run_count = 0;
+}
+
+// Find cluster number index of a file and the length of the run of
+// consecutive clusters it starts, counting at most wanted clusters.
+// Returns the length, or 0 past the end of the chain or on error.
+static uint32_t fat32_run(struct mega65_fat32_file* file, const uint32_t index,
+    const uint32_t wanted, uint32_t* cluster)
+{
+    uint32_t length;
+    uint16_t low, high, middle;
+
+    if (!file->runs) {
+        if (fat32_locate(file, index)) {
+            return 0;
+        }
+        for (length = 1;
+             length < wanted && fat32_next(file->cluster) == file->cluster + 1;
+             ++length) {
+            ++file->cluster;
+            ++file->cluster_index;
+        }
+        *cluster = file->cluster - (length - 1);
+        return length;
+    }
 
-    for (offset = 0; offset < 512; offset += 32) {
-        if (sector_buffer[offset] > ' ') {
+    // Try the last run used and the one after it, for sequential reads,
+    // before searching the list
+    if (file->run >= file->run_count) {
+        return 0;
+    }
+    lcopy(run_address(file, file->run), (uint32_t)runs, 16);
+    if (index >= runs[1].index && file->run + 1 < file->run_count) {
+        lcopy(run_address(file, ++file->run), (uint32_t)runs, 16);
+    }
+    if (index < runs[0].index || index >= runs[1].index) {
+        low = 0;
+        high = file->run_count;
+        while (high - low > 1) {
+            middle = (low + high) >> 1;
+            lcopy(run_address(file, middle), (uint32_t)runs, 4);
+            if (runs[0].index <= index) {
+                low = middle;
+            }
+            else {
+                high = middle;
+            }
+        }
+        file->run = low;
+        lcopy(run_address(file, low), (uint32_t)runs, 16);
+        if (index >= runs[1].index) {
+            return 0;
+        }
+    }
+    *cluster = runs[0].cluster + (index - runs[0].index);
+    length = runs[1].index - index;
+    return length < wanted ? length : wanted;
+}
+
+static uint32_t extent_address(const uint16_t index)
+{
+    return free_extents + ((uint32_t)index << 3);
+}
+
+static void free_extent_append(const uint32_t start, const uint32_t count)
+{
+    uint32_t grown;
+
+    if (free_extent_count == free_extent_capacity) {
+        if (free_extent_capacity == EXTENT_MAX
+            || !(grown = lrealloc(free_extents,
+                     (uint32_t)(free_extent_capacity + EXTENT_GROWTH) << 3))) {
+            return; // out of memory, so the run is not used
+        }
+        free_extents = grown;
+        free_extent_capacity += EXTENT_GROWTH;
+    }
+    extent.start = start;
+    extent.count = count;
+    lcopy((uint32_t)&extent, extent_address(free_extent_count++), 8);
+    free_clusters += count;
+}
+
+// Build the list of free clusters from the first FAT. The FAT sectors are
+// scanned in place in the mapped SD card buffer.
+static void free_extents_build(void)
+{
+    const uint8_t* fat;
+    uint32_t cluster = 0;
+    uint32_t run = 0;
+    uint32_t sector;
+    uint8_t i;
+
+    lfree(free_extents);
+    free_extents = 0;
+    free_extent_count = 0;
+    free_extent_capacity = 0;
+    free_clusters = 0;
+
+    // The card is read directly, so it must be up to date
+    sdcache_flush();
+    for (sector = 0; sector < fat_sectors && cluster < cluster_count + 2;
+         ++sector) {
+        if (!(fat = mega65_sdcard_acquire(fat_begin + sector))) {
+            break;
+        }
+        for (i = 0; i < 128 && cluster < cluster_count + 2;
+             ++i, ++cluster, fat += 4) {
+            if (cluster >= 2 && !(fat[0] | fat[1] | fat[2] | (fat[3] & 0x0f))) {
+                ++run;
+            }
+            else if (run) {
+                free_extent_append(cluster - run, run);
+                run = 0;
+            }
+        }
+    }
+    if (run) {
+        free_extent_append(cluster - run, run);
+    }
+    mega65_sdcard_release();
+    loaded_sector = NO_SECTOR;
+    free_extents_built = 1;
+}
+
+// Take the first run of count free clusters from the free list, or return 0
+static uint32_t free_extents_take(const uint32_t count)
+{
+    uint16_t i;
+
+    if (!free_extents_built) {
+        free_extents_build();
+    }
+    for (i = 0; i < free_extent_count; ++i) {
+        lcopy(extent_address(i), (uint32_t)&extent, 8);
+        if (extent.count >= count) {
+            extent.start += count;
+            extent.count -= count;
+            lcopy((uint32_t)&extent, extent_address(i), 8);
+            free_clusters -= count;
+            return extent.start - count;
+        }
+    }
+    return 0;
+}
+
+// Return a run taken with free_extents_take() to the free list
+static void free_extents_give(const uint32_t start, const uint32_t count)
+{
+    uint16_t i;
+
+    for (i = 0; i < free_extent_count; ++i) {
+        lcopy(extent_address(i), (uint32_t)&extent, 8);
+        if (extent.start == start + count) {
+            extent.start = start;
+            extent.count += count;
+            lcopy((uint32_t)&extent, extent_address(i), 8);
+            free_clusters += count;
+            return;
+        }
+    }
+    free_extent_append(start, count);
+}
+
+// FAT entry of cluster in a chain ending at last, or 0 to free it
+static uint32_t chain_entry(
+    const uint32_t cluster, const uint32_t last, const uint8_t release)
+{
+    if (release) {
+        return 0;
+    }
+    return cluster == last ? END_OF_CHAIN : cluster + 1;
+}
+
+// Point the FAT entries of clusters from cluster to last, but not past the
+// end of their FAT sector, to the next cluster, or free them if release is
+// set, in every copy of the FAT. Returns the cluster after the last one done.
+static uint32_t fat32_chain_sector(
+    uint32_t cluster, const uint32_t last, const uint8_t release)
+{
+    const uint32_t start = cluster;
+    uint32_t sector;
+    uint16_t offset;
+    uint8_t copy;
+
+    for (copy = 0; copy < fat_copies; ++copy) {
+        cluster = start;
+        sector = fat_begin + copy * fat_sectors + (cluster >> 7);
+        if (sdcache_read(sector)) {
+            return 0;
+        }
+        do {
+            offset = (uint16_t)(cluster & 0x7f) << 2;
+            put32(offset,
+                chain_entry(cluster, last, release)
+                    | ((uint32_t)(sector_buffer[offset + 3] & 0xf0) << 24));
+            ++cluster;
+        } while (cluster <= last && (cluster & 0x7f));
+        if (sdcache_write(sector)) {
+            return 0;
+        }
+    }
+    return cluster;
+}
+
+// Link count clusters from first into a chain, or free them if release is
+// set, in every copy of the FAT. FAT sectors that are covered completely are
+// built in far memory and written to all copies with one multi-sector write
+// per batch. The batch is aligned to 512 bytes, like the sector cache, so
+// that no sector straddles a 64 kB bank.
+static uint8_t fat32_write_chain(
+    uint32_t cluster, const uint32_t count, const uint8_t release)
+{
+    const uint32_t last = cluster + count - 1;
+    const uint32_t memory
+        = count > 127 ? lmalloc(((uint32_t)FAT_BATCH << 9) + 256) : 0;
+    const uint32_t batch = (memory + 511) & ~511UL;
+    uint32_t sector;
+    uint8_t result = FAT32_ERROR;
+    uint8_t sectors, copy, i;
+
+    loaded_sector = NO_SECTOR;
+    while (cluster <= last) {
+        if ((cluster & 0x7f) || last - cluster < 127 || !batch) {
+            if (!(cluster = fat32_chain_sector(cluster, last, release))) {
+                goto done;
+            }
             continue;
         }
-        else {
+        sector = cluster >> 7;
+        for (sectors = 0; sectors < FAT_BATCH && last - cluster >= 127;
+             ++sectors) {
+            for (i = 0; i < 128; ++i, ++cluster) {
+                put32((uint16_t)i << 2, chain_entry(cluster, last, release));
+            }
+            lcopy((uint32_t)sector_buffer, batch + ((uint16_t)sectors << 9),
+                512);
+        }
+        for (copy = 0; copy < fat_copies; ++copy) {
+            sdcache_discard(fat_begin + copy * fat_sectors + sector, sectors);
+            if (mega65_sdcard_writesectors(
+                    fat_begin + copy * fat_sectors + sector, sectors, batch)) {
+                goto done;
+            }
+        }
+    }
+    result = 0;
+done:
+    lfree(memory);
+    return result;
+}
+
+// Free a chain that no directory entry refers to, after a failed create
+static void fat32_release(const uint32_t cluster, const uint32_t count)
+{
+    fat32_write_chain(cluster, count, 1);
+    free_extents_give(cluster, count);
+    sdcache_flush();
+}
+
+// Point the FAT entry of cluster to next, in every copy of the FAT
+static uint8_t fat32_link(const uint32_t cluster, const uint32_t next)
+{
+    const uint16_t offset = (uint16_t)(cluster & 0x7f) << 2;
+    uint32_t sector;
+    uint8_t copy;
+
+    loaded_sector = NO_SECTOR;
+    for (copy = 0; copy < fat_copies; ++copy) {
+        sector = fat_begin + copy * fat_sectors + (cluster >> 7);
+        if (sdcache_read(sector)) {
+            return FAT32_ERROR;
+        }
+        put32(offset,
+            next | ((uint32_t)(sector_buffer[offset + 3] & 0xf0) << 24));
+        if (sdcache_write(sector)) {
+            return FAT32_ERROR;
+        }
+    }
+    return 0;
+}
+
+// Find a free entry in a directory, adding a cluster to the directory if it
+// is full. The sector holding the entry is left in sector_buffer.
+static uint8_t fat32_dir_slot(
+    uint32_t cluster, uint32_t* sector, uint16_t* offset)
+{
+    uint32_t last = cluster;
+    uint8_t s;
+
+    while (cluster != END_OF_CHAIN) {
+        for (s = 0; s < (uint8_t)(1 << cluster_shift); ++s) {
+            *sector = cluster_sector(cluster) + s;
+            if (fat32_load(*sector)) {
+                return FAT32_ERROR;
+            }
+            for (*offset = 0; *offset < 512; *offset += 32) {
+                if (!sector_buffer[*offset]
+                    || sector_buffer[*offset] == DELETED) {
+                    return 0;
+                }
+            }
+        }
+        last = cluster;
+        cluster = fat32_next(cluster);
+    }
+
+    // Clear a new cluster before linking it to the end of the directory
+    if (!(cluster = free_extents_take(1))) {
+        return FAT32_ERROR;
+    }
+    mega65_clear_sector_buffer();
+    loaded_sector = NO_SECTOR;
+    for (s = (uint8_t)(1 << cluster_shift); s-- > 0;) {
+        if (sdcache_write(cluster_sector(cluster) + s)) {
+            free_extents_give(cluster, 1);
+            return FAT32_ERROR;
+        }
+    }
+    if (fat32_write_chain(cluster, 1, 0) || fat32_link(last, cluster)) {
+        // End the directory where it was, in case some FAT copies were linked
+        fat32_link(last, END_OF_CHAIN);
+        fat32_release(cluster, 1);
+        return FAT32_ERROR;
+    }
+    *sector = cluster_sector(cluster);
+    *offset = 0;
+    mega65_clear_sector_buffer();
+    return 0;
+}
+
+// Read the layout of a partition from its BIOS parameter block
+static uint8_t fat32_read_bpb(const uint8_t partition)
+{
+    uint16_t entry;
+    uint32_t start, total;
+    uint8_t cluster_sectors;
+
+    if (partition > 3) {
+        return FAT32_ERROR;
+    }
+    entry = 0x1be + (partition << 4);
+    if (fat32_load(0) || get16(510) != 0xaa55
+        || (sector_buffer[entry + 4] != 0x0b
+            && sector_buffer[entry + 4] != 0x0c)) {
+        return FAT32_ERROR;
+    }
+    start = get32(entry + 8);
+
+    // BIOS parameter block
+    if (fat32_load(start) || get16(510) != 0xaa55 || get16(0x0b) != 512
+        || get16(0x16)) {
+        return FAT32_ERROR;
+    }
+    cluster_sectors = sector_buffer[0x0d];
+    fat_copies = sector_buffer[0x10];
+    fat_sectors = get32(0x24);
+    root_cluster = get32(0x2c);
+    total = get32(0x20);
+    fat_begin = start + get16(0x0e);
+    data_begin = fat_begin + fat_copies * fat_sectors;
+
+    for (cluster_shift = 0; cluster_shift < 8; ++cluster_shift) {
+        if ((uint8_t)(1 << cluster_shift) == cluster_sectors) {
+            break;
+        }
+    }
+    if (cluster_shift == 8 || !fat_copies || !fat_sectors
+        || total <= data_begin - start) {
+        return FAT32_ERROR;
+    }
+    cluster_count = (total - (data_begin - start)) >> cluster_shift;
+    if (cluster_count > (fat_sectors << 7) - 2) {
+        cluster_count = (fat_sectors << 7) - 2;
+    }
+    if (root_cluster < 2 || root_cluster >= cluster_count + 2) {
+        return FAT32_ERROR;
+    }
+    return 0;
+}
+
+uint8_t mega65_fat32_mount(const uint8_t partition)
+{
+    mounted = 0;
+    free_extents_built = 0;
+    loaded_sector = NO_SECTOR;
+    index_drop_all();
+    if (fat32_read_bpb(partition)) {
+        return FAT32_ERROR;
+    }
+    mounted = 1;
+    return 0;
+}
+
+uint8_t mega65_fat32_open(struct mega65_fat32_file* file, const char* path)
+{
+    const char* end;
+
+    loaded_sector = NO_SECTOR;
+    if (!mounted) {
+        return FAT32_ERROR;
+    }
+    file->first_cluster = root_cluster;
+    file->size = 0;
+    file->attributes = MEGA65_FAT32_ATTR_DIRECTORY;
+    file->runs = 0;
+    file->run_count = 0;
+    file->entry_sector = 0;
+    file->entry_offset = 0;
+
+    for (;;) {
+        while (*path == '/') {
+            ++path;
+        }
+        if (!*path) {
             break;
         }
+        for (end = path; *end && *end != '/'; ++end) {
+            continue;
+        }
+        if (!(file->attributes & MEGA65_FAT32_ATTR_DIRECTORY)
+            || end - path > MEGA65_FAT32_NAME_MAX
+            || fat32_lookup(
+                file->first_cluster, path, (uint8_t)(end - path), file)) {
+            return FAT32_ERROR;
+        }
+        // ".." in a subdirectory of the root refers to cluster 0
+        if (!file->first_cluster
+            && (file->attributes & MEGA65_FAT32_ATTR_DIRECTORY)) {
+            file->first_cluster = root_cluster;
+        }
+        path = end;
     }
-    if (offset == 512) {
-        //    write_line("ERROR: First sector of root directory already
-        //    full.",0);
+    fat32_rewind(file);
+    if (file->size) {
+        fat32_map(file);
+    }
+    return 0;
+}
+
+uint32_t mega65_fat32_read_far(struct mega65_fat32_file* file,
+    uint32_t offset, const uint32_t destination, uint32_t length)
+{
+    const uint8_t cluster_bits = cluster_shift + 9;
+    uint32_t done = 0;
+    uint32_t chunk, cluster, clusters, sectors;
+    uint16_t skip, sector;
+
+    loaded_sector = NO_SECTOR;
+    if (offset > file->size) {
+        return 0;
+    }
+    if (length > file->size - offset) {
+        length = file->size - offset;
+    }
+    while (length) {
+        sector = (uint16_t)(offset >> 9) & ((1 << cluster_shift) - 1);
+        skip = (uint16_t)offset & 511;
+
+        if (skip || length < 512) {
+            // Partial sector, through sector_buffer
+            if (!fat32_run(file, offset >> cluster_bits, 1, &cluster)) {
+                return MEGA65_FAT32_READ_ERROR;
+            }
+            chunk = 512 - skip;
+            if (chunk > length) {
+                chunk = length;
+            }
+            loaded_sector = NO_SECTOR;
+            if (mega65_sdcard_readsector(cluster_sector(cluster) + sector)) {
+                return MEGA65_FAT32_READ_ERROR;
+            }
+            lcopy((uint32_t)sector_buffer + skip, destination + done,
+                (size_t)chunk);
+        }
+        else {
+            // Whole sectors, up to the end of the run of clusters they are in
+            sectors = length >> 9;
+            if (sectors > MAX_TRANSFER) {
+                sectors = MAX_TRANSFER;
+            }
+            clusters = fat32_run(file, offset >> cluster_bits,
+                (sector + sectors + (1 << cluster_shift) - 1) >> cluster_shift,
+                &cluster);
+            if (!clusters) {
+                return MEGA65_FAT32_READ_ERROR;
+            }
+            if ((clusters << cluster_shift) - sector < sectors) {
+                sectors = (clusters << cluster_shift) - sector;
+            }
+            chunk = sectors << 9;
+            if (mega65_sdcard_readsectors(cluster_sector(cluster) + sector,
+                    (uint16_t)sectors, destination + done)) {
+                return MEGA65_FAT32_READ_ERROR;
+            }
+        }
+        offset += chunk;
+        done += chunk;
+        length -= chunk;
+    }
+    return done;
+}
+
+uint32_t mega65_fat32_read(struct mega65_fat32_file* file,
+    const uint32_t destination, const uint32_t length)
+{
+    const uint32_t done
+        = mega65_fat32_read_far(file, file->position, destination, length);
+
+    if (done != MEGA65_FAT32_READ_ERROR) {
+        file->position += done;
+    }
+    return done;
+}
+
+uint8_t mega65_fat32_seek(
+    struct mega65_fat32_file* file, const uint32_t offset)
+{
+    if (offset > file->size) {
+        return FAT32_ERROR;
+    }
+    file->position = offset;
+    return 0;
+}
+
+void mega65_fat32_close(struct mega65_fat32_file* file)
+{
+    lfree(file->runs);
+    file->runs = 0;
+    file->run_count = 0;
+}
+
+uint32_t mega65_fat32_free_clusters(void)
+{
+    if (mounted && !free_extents_built) {
+        free_extents_build();
+    }
+    return free_clusters;
+}
+
+/*
+  Create a file in the root directory of the new FAT32 filesystem
+  with the indicated name and size.
+
+  The file will be created contiguous on disk, and the first
+  sector of the created file returned. Unless the mounted volume has its
+  FAT at fat1_sector, the partition with that FAT is mounted, or failing
+  that the given layout, with the root directory at the start of cluster 2
+  and 4KB clusters. The clusters are freed again if the directory entry
+  cannot be written.
+
+  Returns first sector of file if successful, or 0xffffffff on failure.
+*/
+unsigned long mega65_fat32_create_contiguous_file(char* name, unsigned long size,
+    unsigned long root_dir_sector, unsigned long fat1_sector, unsigned long fat2_sector)
+{
+    unsigned char i;
+    unsigned short offset;
+    unsigned long clusters;
+    unsigned long start_cluster;
+    uint32_t dir_sector;
+
+    loaded_sector = NO_SECTOR;
+    if (!mounted || fat_begin != fat1_sector) {
+        // Indexes of a previously mounted volume no longer apply
+        index_drop_all();
+
+        // Take the cluster size from the BPB of the partition, if found
+        for (i = 0; i < 4; ++i) {
+            if (!fat32_read_bpb(i) && fat_begin == fat1_sector) {
+                break;
+            }
+        }
+        if (i == 4) {
+            fat_begin = fat1_sector;
+            fat_sectors = fat2_sector - fat1_sector;
+            fat_copies = 2;
+            data_begin = root_dir_sector;
+            root_cluster = 2;
+            cluster_shift = 3;
+            cluster_count = (fat_sectors << 7) - 2;
+        }
+        mounted = 1;
+        free_extents_built = 0;
+    }
+
+    clusters = (size + (512UL << cluster_shift) - 1) >> (cluster_shift + 9);
+    if (!clusters) {
+        clusters = 1;
+    }
+
+    // Contiguous run from the free list, then chained in all copies of FAT
+    start_cluster = free_extents_take(clusters);
+    if (!start_cluster) {
+        //    write_line("ERROR: Could not find enough free clusters in file
+        //    system",0);
+        return 0xffffffffUL;
+    }
+
+    // Free entry in the root directory, which grows if it is full
+    if (fat32_write_chain(start_cluster, clusters, 0)
+        || fat32_dir_slot(root_cluster, &dir_sector, &offset)) {
+        fat32_release(start_cluster, clusters);
         return 0xffffffffUL;
     }
 
@@ -136,7 +1273,16 @@ unsigned long mega65_fat32_create_contiguous_file(char* name, unsigned long size
     sector_buffer[offset + 0x1E] = (unsigned char)(size >> 16L) & 0xff;
     sector_buffer[offset + 0x1F] = (unsigned char)(size >> 24l) & 0xff;
 
-    mega65_sdcard_writesector(root_dir_sector);
+    if (sdcache_write(dir_sector)) {
+        fat32_release(start_cluster, clusters);
+        return 0xffffffffUL;
+    }
+    loaded_sector = NO_SECTOR;
+    index_drop_all();
 
-    return root_dir_sector + (unsigned long)(start_cluster - 2) * 8;
+    // Nothing may be left in the cache when the caller takes over the card
+    if (sdcache_flush()) {
+        return 0xffffffffUL;
+    }
+    return cluster_sector(start_cluster);
 }
@@ -19,6 +19,7 @@
 
 #define MAX_FCI_BLOCKS 16
 #define MAX_WINDOWS 8
+#define FC_DMA_JOBS 8 // chained DMA jobs per submission
 
 #define TOPBORDER_PAL 0x58
 #define BOTTOMBORDER_PAL 0x1e8
@@ -78,6 +79,9 @@ himemPtr nextFreePalMem;   // location of next free palette memory block
 byte infoBlockCount;       // number of info blocks
 byte cgi;                  // universal loop var
 
+static struct dmagic_dmalist fcDmaJobs[FC_DMA_JOBS]; // DMA job arena (bank 0)
+static struct dma_batch fcDmaBatch;
+
 int gTopBorder;
 int gBottomBorder;
 
@@ -403,8 +407,10 @@ void fc_screenmode(byte h640, byte v400, byte rows)
     }
 
     gScreenSize = gScreenRows * gScreenColumns;
-    lfill_skip(gFcioConfig->screenBase, 32, gScreenSize, 2);
-    lfill(gFcioConfig->colourBase, 0, gScreenSize * 2);
+    dma_batch_begin(&fcDmaBatch, fcDmaJobs, FC_DMA_JOBS);
+    dma_batch_fill16(&fcDmaBatch, gFcioConfig->screenBase, 32, gScreenSize);
+    dma_batch_fill(&fcDmaBatch, gFcioConfig->colourBase, 0, gScreenSize * 2);
+    dma_batch_submit(&fcDmaBatch);
 
     HOTREG &= 127; // disable hotreg
 
@@ -465,21 +471,29 @@ void fc_plotExtChar(byte x, byte y, byte c)
 void fc_addGraphicsRect(
     byte x0, byte y0, byte width, byte height, himemPtr bitmapData)
 {
-    static byte x, y;
+    static byte x, y, chunk, done;
     uint32_t adr;
     word currentCharIdx;
 
     currentCharIdx = (word)(bitmapData / 64);
+    adr = gFcioConfig->screenBase + (x0 * 2) + (y0 * gScreenColumns * 2);
 
-    for (y = y0; y < y0 + height; ++y) {
-        for (x = x0; x < x0 + width; ++x) {
-            adr = gFcioConfig->screenBase + (x * 2) + (y * gScreenColumns * 2);
-            lpoke(adr + 1,
-                currentCharIdx / 256); // set highbyte first to avoid blinking
-            lpoke(adr, (uint8_t)(currentCharIdx
-                                 % 256)); // while setting up the screeen
-            currentCharIdx++;
+    // build each row of character indices in fcbuf and copy it in chunks
+    // that fit the buffer, which is followed by the DMA list
+    for (y = 0; y < height; ++y) {
+        for (done = 0; done < width; done += chunk) {
+            chunk = width - done;
+            if (chunk > FCBUFSIZE / 2) {
+                chunk = FCBUFSIZE / 2;
+            }
+            for (x = 0; x < chunk; ++x) {
+                fcbuf[x * 2] = (char)(currentCharIdx % 256);
+                fcbuf[x * 2 + 1] = (char)(currentCharIdx / 256);
+                currentCharIdx++;
+            }
+            lcopy((uint32_t)fcbuf, adr + done * 2, chunk * 2);
         }
+        adr += gScreenColumns * 2;
     }
 }
 
@@ -669,47 +683,60 @@ fciInfo* fc_displayFCIFile(char* filename, byte x0, byte y0)
     return info;
 }
 
+// queue a block of characters on fcDmaBatch; caller begins and submits
+static void fc_blockBatched(
+    byte x0, byte y0, byte width, byte height, byte character, byte col)
+{
+    word bas;
+    word stride;
+
+    stride = gScreenColumns * 2;
+    bas = (gCurrentWin->x0 + x0) * 2 + ((gCurrentWin->y0 + y0) * stride);
+
+    // use DMAgic to fill FCM screens with skip byte... PGS, I love you!
+    dma_batch_fill_rect(&fcDmaBatch, gFcioConfig->screenBase + bas, stride,
+        character, width, height, 2);
+    dma_batch_fill_rect(&fcDmaBatch, gFcioConfig->screenBase + bas + 1, stride,
+        0, width, height, 2);
+    dma_batch_fill_rect(&fcDmaBatch, gFcioConfig->colourBase + bas, stride, 0,
+        width, height, 2);
+    dma_batch_fill_rect(&fcDmaBatch, gFcioConfig->colourBase + bas + 1, stride,
+        col, width, height, 2);
+}
+
+// queue a vertical move of the current window's contents by one row
+static void fc_moveWinBatched(byte fromRow, byte toRow)
+{
+    word stride;
+    himemPtr from, to;
+
+    stride = gScreenColumns * 2;
+    from = (himemPtr)(gCurrentWin->x0 * 2 + (fromRow * stride));
+    to = (himemPtr)(gCurrentWin->x0 * 2 + (toRow * stride));
+    dma_batch_copy_rect(&fcDmaBatch, gFcioConfig->screenBase + from, stride,
+        gFcioConfig->screenBase + to, stride, gCurrentWin->width * 2,
+        gCurrentWin->height - 1);
+    dma_batch_copy_rect(&fcDmaBatch, gFcioConfig->colourBase + from, stride,
+        gFcioConfig->colourBase + to, stride, gCurrentWin->width * 2,
+        gCurrentWin->height - 1);
+}
+
 void fc_scrollUp(void)
 {
-    static byte y;
-    uint32_t bas0, bas1;
-    for (y = gCurrentWin->y0; y < gCurrentWin->y0 + gCurrentWin->height - 1;
-         y++) {
-        bas0 = gFcioConfig->screenBase
-             + (himemPtr)(gCurrentWin->x0 * 2 + (y * gScreenColumns * 2));
-        bas1 = gFcioConfig->screenBase
-             + (himemPtr)(gCurrentWin->x0 * 2 + ((y + 1) * gScreenColumns * 2));
-        lcopy((uint32_t)bas1, (uint32_t)bas0, gCurrentWin->width * 2);
-        bas0 = gFcioConfig->colourBase
-             + (himemPtr)(gCurrentWin->x0 * 2 + (y * gScreenColumns * 2));
-        bas1 = gFcioConfig->colourBase
-             + (himemPtr)(gCurrentWin->x0 * 2 + ((y + 1) * gScreenColumns * 2));
-        lcopy(bas1, bas0, gCurrentWin->width * 2);
-    }
-    fc_line(0, gCurrentWin->height - 1, gCurrentWin->width, 32,
+    dma_batch_begin(&fcDmaBatch, fcDmaJobs, FC_DMA_JOBS);
+    fc_moveWinBatched(gCurrentWin->y0 + 1, gCurrentWin->y0);
+    fc_blockBatched(0, gCurrentWin->height - 1, gCurrentWin->width, 1, 32,
         gCurrentWin->textcolor);
+    dma_batch_submit(&fcDmaBatch);
 }
 
 void fc_scrollDown(void)
 {
-    signed char y;
-    uint32_t bas0, bas1;
-    for (y = gCurrentWin->y0 + gCurrentWin->height - 2; y >= gCurrentWin->y0;
-         y--) {
-        bas0 = gFcioConfig->screenBase
-             + (himemPtr)(gCurrentWin->x0 * 2 + (y * gScreenColumns * 2));
-        bas1 = gFcioConfig->screenBase
-             + (himemPtr)(gCurrentWin->x0 * 2 + ((y + 1) * gScreenColumns * 2));
-        lcopy(bas0, bas1, gCurrentWin->width * 2);
-
-        bas0 = gFcioConfig->colourBase
-             + (himemPtr)(gCurrentWin->x0 * 2 + (y * gScreenColumns * 2));
-        bas1 = gFcioConfig->colourBase
-             + (himemPtr)(gCurrentWin->x0 * 2 + ((y + 1) * gScreenColumns * 2));
-        lcopy(bas0, bas1, gCurrentWin->width * 2);
-    }
-
-    fc_line(0, 0, gCurrentWin->width, 32, gCurrentWin->textcolor);
+    // lcopy_rect() works bottom-up as the destination is above the source
+    dma_batch_begin(&fcDmaBatch, fcDmaJobs, FC_DMA_JOBS);
+    fc_moveWinBatched(gCurrentWin->y0, gCurrentWin->y0 + 1);
+    fc_blockBatched(0, 0, gCurrentWin->width, 1, 32, gCurrentWin->textcolor);
+    dma_batch_submit(&fcDmaBatch);
 }
 
 void cr(void)
@@ -998,27 +1025,15 @@ char* fc_input(byte maxlen)
 
 void fc_line(byte x, byte y, byte width, byte character, byte col)
 {
-    word bas;
-
-    bas = (gCurrentWin->x0 + x) * 2
-        + ((gCurrentWin->y0 + y) * gScreenColumns * 2);
-
-    // use DMAgic to fill FCM screens with skip byte... PGS, I love you!
-    lfill_skip(gFcioConfig->screenBase + bas, character, width, 2);
-    lfill_skip(gFcioConfig->screenBase + bas + 1, 0, width, 2);
-    lfill_skip(gFcioConfig->colourBase + bas, 0, width, 2);
-    lfill_skip(gFcioConfig->colourBase + bas + 1, col, width, 2);
-
-    return;
+    fc_block(x, y, width, 1, character, col);
 }
 
 void fc_block(
     byte x0, byte y0, byte width, byte height, byte character, byte col)
 {
-    static byte y;
-    for (y = 0; y < height; ++y) {
-        fc_line(x0, y0 + y, width, character, col);
-    }
+    dma_batch_begin(&fcDmaBatch, fcDmaJobs, FC_DMA_JOBS);
+    fc_blockBatched(x0, y0, width, height, character, col);
+    dma_batch_submit(&fcDmaBatch);
 }
 
 void fc_center(byte x, byte y, byte width, char* text)
@@ -1050,18 +1065,36 @@ char fc_getkeyP(byte x, byte y, const char* prompt)
     return fc_cgetc();
 }
 
-void fc_hlinexy(byte x, byte y, byte width, byte lineChar)
+// plot extended character c over a block of width x height cells at x, y
+static void fc_plotExtBlock(byte x, byte y, byte width, byte height, byte c)
 {
-    for (cgi = x; cgi < x + width; cgi++) {
-        fc_plotExtChar(
-            gCurrentWin->x0 + x + cgi, gCurrentWin->y0 + y, lineChar);
+    word charIdx, stride;
+    uint32_t adr;
+
+    if (!width || !height) {
+        return;
     }
+    charIdx = (word)((gFcioConfig->reservedBitmapBase / 64) + c);
+    stride = gScreenColumns * 2;
+    adr = gFcioConfig->screenBase + (x * 2) + (y * stride);
+    // low and high bytes are interleaved: fill each with a step of 2, one
+    // job per row so that wide screens don't overflow the 8-bit step
+    dma_batch_begin(&fcDmaBatch, fcDmaJobs, FC_DMA_JOBS);
+    dma_batch_fill_rect(&fcDmaBatch, adr, stride, (uint8_t)(charIdx % 256),
+        width, height, 2);
+    dma_batch_fill_rect(&fcDmaBatch, adr + 1, stride,
+        (uint8_t)(charIdx / 256), width, height, 2);
+    dma_batch_submit(&fcDmaBatch);
+}
+
+void fc_hlinexy(byte x, byte y, byte width, byte lineChar)
+{
+    fc_plotExtBlock(
+        gCurrentWin->x0 + x, gCurrentWin->y0 + y, width, 1, lineChar);
 }
 
 void fc_vlinexy(byte x, byte y, byte height, byte lineChar)
 {
-    for (cgi = y; cgi < y + height; cgi++) {
-        fc_plotExtChar(
-            gCurrentWin->x0 + x, gCurrentWin->y0 + y + cgi, lineChar);
-    }
+    fc_plotExtBlock(
+        gCurrentWin->x0 + x, gCurrentWin->y0 + y, 1, height, lineChar);
 }
@@ -15,3 +15,30 @@ void usleep(uint32_t micros)
     }
     return;
 }
+
+void hal_timer_start(void)
+{
+    POKE(0xDD0E, 0x00);
+    POKE(0xDD0F, 0x00);
+    POKE(0xDD04, 0xff);
+    POKE(0xDD05, 0xff);
+    POKE(0xDD06, 0xff);
+    POKE(0xDD07, 0xff);
+    POKE(0xDD0F, 0x51); // count timer A underflows, force load, start
+    POKE(0xDD0E, 0x11); // count phi2 cycles, force load, start
+}
+
+uint32_t hal_timer_ticks(void)
+{
+    uint16_t hi;
+    uint8_t mid, lo;
+
+    // Read again if the high byte of timer A changed while its low byte was
+    // being read, or timer B changed while timer A was being read
+    do {
+        hi = PEEK16(0xDD06);
+        mid = PEEK(0xDD05);
+        lo = PEEK(0xDD04);
+    } while (mid != PEEK(0xDD05) || hi != PEEK16(0xDD06));
+    return ~(((uint32_t)hi << 16) | ((uint16_t)mid << 8) | lo);
+}
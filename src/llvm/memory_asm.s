@@ -31,3 +31,47 @@ lpeek:
         ldz #0
         lda [__rc4], z
         rts
+
+.global lcopy_cpu
+.section .text.lcopy_cpu,"ax",@progbits
+lcopy_cpu:
+        ; copy 32-bit source address (a, x, rc2-rc3) to rc9-rc12
+        ; 32-bit destination address is already in rc4-rc7
+        sta __rc9
+        stx __rc10
+        lda __rc2
+        sta __rc11
+        lda __rc3
+        sta __rc12
+        ; 8-bit byte count (rc8); 0 = 256 bytes
+        ldz #0
+1:
+        lda [__rc9], z
+        sta [__rc4], z
+        inz
+        cpz __rc8
+        bne 1b
+        ; leave z cleared, as (zp) addressing assumes
+        ldz #0
+        rts
+
+.global lfill_cpu
+.section .text.lfill_cpu,"ax",@progbits
+lfill_cpu:
+        ; copy 32-bit destination address (a, x, rc2-rc3) to rc6-rc9
+        sta __rc6
+        stx __rc7
+        lda __rc2
+        sta __rc8
+        lda __rc3
+        sta __rc9
+        ; 8-bit fill value (rc4) and byte count (rc5); 0 = 256 bytes
+        lda __rc4
+        ldz #0
+1:
+        sta [__rc6], z
+        inz
+        cpz __rc5
+        bne 1b
+        ldz #0
+        rts
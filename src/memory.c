@@ -1,58 +1,124 @@
 #include <mega65/memory.h>
 
+/**
+ * @brief DMA list with both source and destination step options
+ */
+struct dmagic_dmalist_step {
+    // Enhanced DMA options
+    uint8_t option_0b;
+    uint8_t option_80;
+    uint8_t source_mb;
+    uint8_t option_81;
+    uint8_t dest_mb;
+    uint8_t option_82;
+    uint8_t source_skip_fraction;
+    uint8_t option_83;
+    uint8_t source_skip;
+    uint8_t option_84;
+    uint8_t dest_skip_fraction;
+    uint8_t option_85;
+    uint8_t dest_skip;
+    uint8_t end_of_options;
+
+    // F018B format DMA request
+    uint8_t command;
+    uint16_t count;
+    uint16_t source_addr;
+    uint8_t source_bank;
+    uint16_t dest_addr;
+    uint8_t dest_bank;
+    uint8_t sub_cmd;
+    uint16_t modulo;
+};
+
 #ifdef __clang__
 volatile struct dmagic_dmalist dmalist;
 volatile uint8_t dma_byte;
+typedef volatile struct dmagic_dmalist dma_job_t;
 #else
 struct dmagic_dmalist dmalist;
 uint8_t dma_byte;
+typedef struct dmagic_dmalist dma_job_t;
 #endif
 
+// Pre-initialised DMA lists, one per operation, so that each call only
+// patches the address and count fields that actually change.
+static dma_job_t dma_peek_job = { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x85, 1, 0x00,
+    DMA_COPY_CMD, 1, 0, 0, 0, 0, 0, 0 };
+static dma_job_t dma_poke_job = { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x85, 1, 0x00,
+    DMA_COPY_CMD, 1, 0, 0, 0, 0, 0, 0 };
+static dma_job_t dma_copy_job = { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x85, 1, 0x00,
+    DMA_COPY_CMD, 0, 0, 0, 0, 0, 0, 0 };
+static dma_job_t dma_fill_job = { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x85, 1, 0x00,
+    DMA_FILL_CMD, 0, 0, 0, 0, 0, 0, 0 };
+#ifdef __clang__
+static volatile struct dmagic_dmalist_step dma_copy_step_job
+#else
+static struct dmagic_dmalist_step dma_copy_step_job
+#endif
+    = { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x82, 0x00, 0x83, 1, 0x84, 0x00, 0x85, 1,
+          0x00, DMA_COPY_CMD, 0, 0, 0, 0, 0, 0, 0 };
+
+// Arena for the row jobs of lcopy_rect() and lfill_rect()
+#define DMA_RECT_JOBS 8
+static struct dmagic_dmalist dma_rect_jobs[DMA_RECT_JOBS];
+static struct dma_batch dma_rect_batch;
+
+// Chained byte-lane fills for lfill32(); lfill16() runs the last two
+static dma_job_t dma_pattern_jobs[4] = {
+    { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x85, 4, 0x00, DMA_FILL_CMD | DMA_CHAIN, 0,
+        0, 0, 0, 0, 0, 0 },
+    { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x85, 4, 0x00, DMA_FILL_CMD | DMA_CHAIN, 0,
+        0, 0, 0, 0, 0, 0 },
+    { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x85, 2, 0x00, DMA_FILL_CMD | DMA_CHAIN, 0,
+        0, 0, 0, 0, 0, 0 },
+    { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x85, 2, 0x00, DMA_FILL_CMD, 0, 0, 0, 0, 0,
+        0, 0 },
+};
+
+// Shared by swap and mix; the command byte is patched per call
+static dma_job_t dma_op_job = { 0x0b, 0x80, 0x00, 0x81, 0x00, 0x85, 1, 0x00,
+    DMA_SWAP_CMD, 0, 0, 0, 0, 0, 0, 0 };
+
+/**
+ * @brief Trigger an enhanced DMA job
+ * @param list Address of the DMA list in bank 0
+ */
+static void dma_trigger(const uint16_t list)
+{
+    mega65_io_enable();
+
+    // Now run DMA job (to and from anywhere, and list is in low 1MB)
+    POKE(0xd702U, 0);
+    POKE(0xd704U, 0x00); // List is in $00xxxxx
+    POKE(0xd701U, list >> 8);
+    POKE(0xd705U, list & 0xff); // triggers enhanced DMA
+}
+
 /**
  * @brief Perform DMA operation
  */
 void do_dma(void)
 {
     //  unsigned char i;
-    mega65_io_enable();
-
     //  for(i=0;i<24;i++)
     //    printf("%02x ",PEEK(i+(uint16_t)&dmalist));
     //  printf("\n");
     //  while(1) continue;
 
-    // Now run DMA job (to and from anywhere, and list is in low 1MB)
-    POKE(0xd702U, 0);
-    POKE(0xd704U, 0x00); // List is in $00xxxxx
-    POKE(0xd701U, ((uint16_t)&dmalist) >> 8);
-    POKE(0xd705U, ((uint16_t)&dmalist) & 0xff); // triggers enhanced DMA
+    dma_trigger((uint16_t)&dmalist);
 }
 
 uint8_t dma_peek(uint32_t address)
 {
     // Read the byte at <address> in 28-bit address space
-    // XXX - Optimise out repeated setup etc
-    // (separate DMA lists for peek, poke and copy should
-    // save space, since most fields can stay initialised).
-
-    dmalist.option_0b = 0x0b;
-    dmalist.option_80 = 0x80;
-    dmalist.source_mb = (uint8_t)(address >> 20);
-    dmalist.option_81 = 0x81;
-    dmalist.dest_mb = 0x00; // dma_byte lives in 1st MB
-    dmalist.option_85 = 0x85;
-    dmalist.dest_skip = 1;
-    dmalist.end_of_options = 0x00;
-    dmalist.sub_cmd = 0x00;
-
-    dmalist.command = DMA_COPY_CMD;
-    dmalist.count = 1;
-    dmalist.source_addr = address & 0xffff;
-    dmalist.source_bank = (address >> 16) & 0x0f;
-    dmalist.dest_addr = (uint16_t)&dma_byte;
-    dmalist.dest_bank = 0;
-
-    do_dma();
+    // (dma_byte lives in 1st MB, bank 0)
+    dma_peek_job.source_mb = (uint8_t)(address >> 20);
+    dma_peek_job.source_addr = address & 0xffff;
+    dma_peek_job.source_bank = (address >> 16) & 0x0f;
+    dma_peek_job.dest_addr = (uint16_t)&dma_byte;
+
+    dma_trigger((uint16_t)&dma_peek_job);
 
     return dma_byte;
 }
@@ -85,108 +151,374 @@ void lpoke(uint32_t address, uint8_t value)
 
 void dma_poke(uint32_t address, uint8_t value)
 {
-    dmalist.option_0b = 0x0b;
-    dmalist.option_80 = 0x80;
-    dmalist.source_mb = 0x00; // dma_byte lives in 1st MB
-    dmalist.option_81 = 0x81;
-    dmalist.dest_mb = (uint8_t)(address >> 20);
-    dmalist.option_85 = 0x85;
-    dmalist.dest_skip = 1;
-    dmalist.end_of_options = 0x00;
-    dmalist.sub_cmd = 0x00;
-
+    // dma_byte lives in 1st MB, bank 0
     dma_byte = value;
-    dmalist.command = DMA_COPY_CMD;
-    dmalist.count = 1;
-    dmalist.source_addr = (uint16_t)&dma_byte;
-    dmalist.source_bank = 0;
-    dmalist.dest_addr = address & 0xffff;
-    dmalist.dest_bank = (address >> 16) & 0x0f;
-
-    do_dma();
+    dma_poke_job.source_addr = (uint16_t)&dma_byte;
+    dma_poke_job.dest_mb = (uint8_t)(address >> 20);
+    dma_poke_job.dest_addr = address & 0xffff;
+    dma_poke_job.dest_bank = (address >> 16) & 0x0f;
+
+    dma_trigger((uint16_t)&dma_poke_job);
     return;
 }
 
 void lcopy(
     uint32_t source_address, uint32_t destination_address, size_t count)
 {
-    dmalist.option_0b = 0x0b;
-    dmalist.option_80 = 0x80;
-    dmalist.source_mb = (uint8_t)(source_address >> 20);
-    dmalist.option_81 = 0x81;
-    dmalist.dest_mb = (uint8_t)(destination_address >> 20);
-    dmalist.option_85 = 0x85;
-    dmalist.dest_skip = 1;
-    dmalist.end_of_options = 0x00;
-    dmalist.sub_cmd = 0x00;
-
-    dmalist.command = DMA_COPY_CMD;
-    dmalist.count = count;
-    dmalist.sub_cmd = 0;
-    dmalist.source_addr = source_address & 0xffff;
-    dmalist.source_bank = (source_address >> 16) & 0x0f;
+    if (count && count <= LCOPY_CPU_MAX) {
+        lcopy_cpu(source_address, destination_address, (uint8_t)count);
+        return;
+    }
+    lcopy_dma(source_address, destination_address, count);
+}
+
+void lcopy_dma(
+    uint32_t source_address, uint32_t destination_address, size_t count)
+{
+    dma_copy_job.source_mb = (uint8_t)(source_address >> 20);
+    dma_copy_job.dest_mb = (uint8_t)(destination_address >> 20);
+    dma_copy_job.count = count;
+    dma_copy_job.source_addr = source_address & 0xffff;
+    dma_copy_job.source_bank = (source_address >> 16) & 0x0f;
     // User should provide 28-bit address for IO
     // (otherwise we can't DMA to/from RAM under IO)
     //  if (source_address>=0xd000 && source_address<0xe000)
     //    dmalist.source_bank|=0x80;
-    dmalist.dest_addr = destination_address & 0xffff;
-    dmalist.dest_bank = (destination_address >> 16) & 0x0f;
+    dma_copy_job.dest_addr = destination_address & 0xffff;
+    dma_copy_job.dest_bank = (destination_address >> 16) & 0x0f;
     // User should provide 28-bit address for IO
     // (otherwise we can't DMA to/from RAM under IO)
     //  if (destination_address>=0xd000 && destination_address<0xe000)
     //    dmalist.dest_bank|=0x80;
 
-    do_dma();
+    dma_trigger((uint16_t)&dma_copy_job);
     return;
 }
 
+void lmove(uint32_t source_address, uint32_t destination_address, size_t count)
+{
+    const uint32_t last = count ? count - 1 : 0xffffUL;
+
+    if (destination_address <= source_address
+        || destination_address > source_address + last) {
+        lcopy(source_address, destination_address, count);
+        return;
+    }
+
+    // Destination overlaps the end of the source: copy last byte first
+    source_address += last;
+    destination_address += last;
+    dma_copy_job.source_mb = (uint8_t)(source_address >> 20);
+    dma_copy_job.dest_mb = (uint8_t)(destination_address >> 20);
+    dma_copy_job.count = count;
+    dma_copy_job.source_addr = source_address & 0xffff;
+    dma_copy_job.source_bank = ((source_address >> 16) & 0x0f) | DMA_DECREMENT;
+    dma_copy_job.dest_addr = destination_address & 0xffff;
+    dma_copy_job.dest_bank
+        = ((destination_address >> 16) & 0x0f) | DMA_DECREMENT;
+
+    dma_trigger((uint16_t)&dma_copy_job);
+}
+
+void lcopy_skip(uint32_t source_address, uint8_t source_step,
+    uint32_t destination_address, uint8_t destination_step, size_t count)
+{
+    dma_copy_step_job.source_mb = (uint8_t)(source_address >> 20);
+    dma_copy_step_job.dest_mb = (uint8_t)(destination_address >> 20);
+    dma_copy_step_job.source_skip = source_step;
+    dma_copy_step_job.dest_skip = destination_step;
+    dma_copy_step_job.count = count;
+    dma_copy_step_job.source_addr = source_address & 0xffff;
+    dma_copy_step_job.source_bank = (source_address >> 16) & 0x0f;
+    dma_copy_step_job.dest_addr = destination_address & 0xffff;
+    dma_copy_step_job.dest_bank = (destination_address >> 16) & 0x0f;
+
+    dma_trigger((uint16_t)&dma_copy_step_job);
+}
+
 void lfill(uint32_t destination_address, uint8_t value, size_t count)
 {
-    dmalist.option_0b = 0x0b;
-    dmalist.option_80 = 0x80;
-    dmalist.source_mb = 0x00;
-    dmalist.option_81 = 0x81;
-    dmalist.dest_mb = (uint8_t)(destination_address >> 20);
-    dmalist.option_85 = 0x85;
-    dmalist.dest_skip = 1;
-    dmalist.end_of_options = 0x00;
-
-    dmalist.command = DMA_FILL_CMD;
-    dmalist.sub_cmd = 0;
-    dmalist.count = count;
-    dmalist.source_addr = value;
-    dmalist.dest_addr = destination_address & 0xffff;
-    dmalist.dest_bank = (destination_address >> 16) & 0x0f;
+    if (count && count <= LFILL_CPU_MAX) {
+        lfill_cpu(destination_address, value, (uint8_t)count);
+        return;
+    }
+    lfill_skip(destination_address, value, count, 1);
+}
+
+void lfill_dma(uint32_t destination_address, uint8_t value, size_t count)
+{
+    lfill_skip(destination_address, value, count, 1);
+}
+
+void lfill_skip(
+    uint32_t destination_address, uint8_t value, size_t count, uint8_t skip)
+{
+    dma_fill_job.dest_mb = (uint8_t)(destination_address >> 20);
+    dma_fill_job.dest_skip = skip;
+    dma_fill_job.count = count;
+    dma_fill_job.source_addr = value;
+    dma_fill_job.dest_addr = destination_address & 0xffff;
+    dma_fill_job.dest_bank = (destination_address >> 16) & 0x0f;
     // User should provide 28-bit address for IO
     // (otherwise we can't DMA to/from RAM under IO)
     //  if (destination_address>=0xd000 && destination_address<0xe000)
     //    dmalist.dest_bank|=0x80;
 
-    do_dma();
+    dma_trigger((uint16_t)&dma_fill_job);
     return;
 }
 
-void lfill_skip(
-    uint32_t destination_address, uint8_t value, size_t count, uint8_t skip)
+/**
+ * @brief Fill with a 16- or 32-bit pattern using one chained fill per byte
+ */
+static void dma_fill_pattern(uint32_t destination_address, uint32_t pattern,
+    const size_t count, const uint8_t width)
 {
-    dmalist.option_0b = 0x0b;
-    dmalist.option_80 = 0x80;
-    dmalist.source_mb = 0x00;
-    dmalist.option_81 = 0x81;
-    dmalist.dest_mb = (uint8_t)(destination_address >> 20);
-    dmalist.option_85 = 0x85;
-    dmalist.dest_skip = skip;
-    dmalist.end_of_options = 0x00;
-
-    dmalist.command = DMA_FILL_CMD;
-    dmalist.sub_cmd = 0;
-    dmalist.count = count;
-    dmalist.source_addr = value;
-    dmalist.dest_addr = destination_address & 0xffff;
-    dmalist.dest_bank = (destination_address >> 16) & 0x0f;
-
-    do_dma();
-    return;
+    dma_job_t* const first = &dma_pattern_jobs[4 - width];
+    dma_job_t* job = first;
+    uint8_t i;
+
+    for (i = 0; i < width; ++i, ++job, ++destination_address) {
+        job->dest_mb = (uint8_t)(destination_address >> 20);
+        job->dest_skip = width;
+        job->count = count;
+        job->source_addr = (uint8_t)pattern;
+        job->dest_addr = destination_address & 0xffff;
+        job->dest_bank = (destination_address >> 16) & 0x0f;
+        pattern >>= 8;
+    }
+    dma_trigger((uint16_t)first);
+}
+
+void lfill16(uint32_t destination_address, uint16_t pattern, size_t count)
+{
+    dma_fill_pattern(destination_address, pattern, count, 2);
+}
+
+void lfill32(uint32_t destination_address, uint32_t pattern, size_t count)
+{
+    dma_fill_pattern(destination_address, pattern, count, 4);
+}
+
+/**
+ * @brief Run a two-operand job (swap or mix) from the shared template
+ */
+static void dma_op(const uint8_t command, const uint32_t source_address,
+    const uint32_t destination_address, const size_t count)
+{
+    dma_op_job.command = command;
+    dma_op_job.source_mb = (uint8_t)(source_address >> 20);
+    dma_op_job.dest_mb = (uint8_t)(destination_address >> 20);
+    dma_op_job.count = count;
+    dma_op_job.source_addr = source_address & 0xffff;
+    dma_op_job.source_bank = (source_address >> 16) & 0x0f;
+    dma_op_job.dest_addr = destination_address & 0xffff;
+    dma_op_job.dest_bank = (destination_address >> 16) & 0x0f;
+
+    dma_trigger((uint16_t)&dma_op_job);
+}
+
+void lswap(uint32_t address1, uint32_t address2, size_t count)
+{
+    dma_op(DMA_SWAP_CMD, address1, address2, count);
+}
+
+void lmix(uint32_t source_address, uint32_t destination_address,
+    size_t count, uint8_t minterms)
+{
+    dma_op(DMA_MIX_CMD | (minterms & 0xf0), source_address,
+        destination_address, count);
+}
+
+/**
+ * @brief Fill in a complete F018B job with enhanced options
+ *
+ * For fill jobs, `source` holds the fill value.
+ */
+static void dma_job_setup(dma_job_t* job, const uint8_t command,
+    const uint32_t source, const uint32_t destination, const size_t count)
+{
+    job->option_0b = 0x0b;
+    job->option_80 = 0x80;
+    job->source_mb = (uint8_t)(source >> 20);
+    job->option_81 = 0x81;
+    job->dest_mb = (uint8_t)(destination >> 20);
+    job->option_85 = 0x85;
+    job->dest_skip = 1;
+    job->end_of_options = 0x00;
+
+    job->command = command;
+    job->count = count;
+    job->source_addr = source & 0xffff;
+    job->source_bank = (source >> 16) & 0x0f;
+    job->dest_addr = destination & 0xffff;
+    job->dest_bank = (destination >> 16) & 0x0f;
+    job->sub_cmd = 0;
+    job->modulo = 0;
+}
+
+void dma_batch_begin(
+    struct dma_batch* batch, struct dmagic_dmalist* arena, uint8_t capacity)
+{
+    batch->jobs = arena;
+    batch->capacity = capacity;
+    batch->count = 0;
+}
+
+/**
+ * @brief Reserve the next job slot of a batch, chaining it to the previous
+ */
+static dma_job_t* dma_batch_next(struct dma_batch* batch)
+{
+    dma_job_t* jobs = (dma_job_t*)batch->jobs;
+
+    if (batch->count == batch->capacity) {
+        dma_batch_submit(batch);
+    }
+    if (batch->count) {
+        jobs[batch->count - 1].command |= DMA_CHAIN;
+    }
+    return &jobs[batch->count++];
+}
+
+void dma_batch_copy(struct dma_batch* batch, uint32_t source_address,
+    uint32_t destination_address, size_t count)
+{
+    dma_job_setup(dma_batch_next(batch), DMA_COPY_CMD, source_address,
+        destination_address, count);
+}
+
+void dma_batch_move(struct dma_batch* batch, uint32_t source_address,
+    uint32_t destination_address, size_t count)
+{
+    const uint32_t last = count ? count - 1 : 0xffffUL;
+    dma_job_t* job = dma_batch_next(batch);
+
+    if (destination_address <= source_address
+        || destination_address > source_address + last) {
+        dma_job_setup(
+            job, DMA_COPY_CMD, source_address, destination_address, count);
+        return;
+    }
+    dma_job_setup(job, DMA_COPY_CMD, source_address + last,
+        destination_address + last, count);
+    job->source_bank |= DMA_DECREMENT;
+    job->dest_bank |= DMA_DECREMENT;
+}
+
+void dma_batch_fill(struct dma_batch* batch, uint32_t destination_address,
+    uint8_t value, size_t count)
+{
+    dma_job_setup(dma_batch_next(batch), DMA_FILL_CMD, value,
+        destination_address, count);
+}
+
+void dma_batch_fill_skip(struct dma_batch* batch, uint32_t destination_address,
+    uint8_t value, size_t count, uint8_t skip)
+{
+    dma_job_t* job = dma_batch_next(batch);
+    dma_job_setup(job, DMA_FILL_CMD, value, destination_address, count);
+    job->dest_skip = skip;
+}
+
+void dma_batch_swap(struct dma_batch* batch, uint32_t address1,
+    uint32_t address2, size_t count)
+{
+    dma_job_setup(
+        dma_batch_next(batch), DMA_SWAP_CMD, address1, address2, count);
+}
+
+void dma_batch_copy_rect(struct dma_batch* batch, uint32_t source_address,
+    uint16_t source_stride, uint32_t destination_address,
+    uint16_t destination_stride, size_t width, uint8_t rows)
+{
+    const uint32_t size = (uint32_t)width * rows;
+
+    if (!rows) {
+        return;
+    }
+    if (source_stride == width && destination_stride == width
+        && size <= 0xffffUL) {
+        // Contiguous block: a single job does it
+        dma_batch_move(batch, source_address, destination_address, size);
+        return;
+    }
+    if (destination_address > source_address) {
+        // Copy bottom-up so that overlapping rows are read before written
+        source_address += (uint32_t)source_stride * (rows - 1);
+        destination_address += (uint32_t)destination_stride * (rows - 1);
+        while (rows--) {
+            dma_batch_move(batch, source_address, destination_address, width);
+            source_address -= source_stride;
+            destination_address -= destination_stride;
+        }
+        return;
+    }
+    while (rows--) {
+        dma_batch_move(batch, source_address, destination_address, width);
+        source_address += source_stride;
+        destination_address += destination_stride;
+    }
+}
+
+void dma_batch_fill16(struct dma_batch* batch, uint32_t destination_address,
+    uint16_t pattern, size_t count)
+{
+    dma_batch_fill_skip(batch, destination_address, (uint8_t)pattern, count, 2);
+    dma_batch_fill_skip(
+        batch, destination_address + 1, (uint8_t)(pattern >> 8), count, 2);
+}
+
+void dma_batch_fill_rect(struct dma_batch* batch,
+    uint32_t destination_address, uint16_t stride, uint8_t value,
+    size_t count, uint8_t rows, uint8_t skip)
+{
+    const uint32_t size = (uint32_t)count * rows;
+
+    if (stride == (uint32_t)count * skip && size <= 0xffffUL) {
+        // Rows are back to back: a single job does it
+        if (rows) {
+            dma_batch_fill_skip(
+                batch, destination_address, value, (size_t)size, skip);
+        }
+        return;
+    }
+    while (rows--) {
+        dma_batch_fill_skip(batch, destination_address, value, count, skip);
+        destination_address += stride;
+    }
+}
+
+void lcopy_rect(uint32_t source_address, uint16_t source_stride,
+    uint32_t destination_address, uint16_t destination_stride, size_t width,
+    uint8_t rows)
+{
+    dma_batch_begin(&dma_rect_batch, dma_rect_jobs, DMA_RECT_JOBS);
+    dma_batch_copy_rect(&dma_rect_batch, source_address, source_stride,
+        destination_address, destination_stride, width, rows);
+    dma_batch_submit(&dma_rect_batch);
+}
+
+void lfill_rect(uint32_t destination_address, uint16_t stride, uint8_t value,
+    size_t width, uint8_t rows)
+{
+    dma_batch_begin(&dma_rect_batch, dma_rect_jobs, DMA_RECT_JOBS);
+    dma_batch_fill_rect(
+        &dma_rect_batch, destination_address, stride, value, width, rows, 1);
+    dma_batch_submit(&dma_rect_batch);
+}
+
+void dma_batch_submit(struct dma_batch* batch)
+{
+    if (batch->count) {
+        dma_trigger((uint16_t)batch->jobs);
+        batch->count = 0;
+    }
+}
+
+void dma_submit_list(const struct dmagic_dmalist* list)
+{
+    dma_trigger((uint16_t)list);
 }
 
 void mega65_io_enable(void)
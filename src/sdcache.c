@@ -0,0 +1,217 @@
+#include <mega65/sdcache.h>
+#include <mega65/sdcard.h>
+#include <mega65/farmem.h>
+#include <mega65/memory.h>
+
+#define NIL 0xff
+#define BUCKETS 16 // must be a power of two
+#define SDCARD_ERROR 0xff
+
+#define SLOT_VALID 0x01
+#define SLOT_DIRTY 0x02
+
+struct sdcache_stats sdcache_stats;
+
+static uint32_t cache_memory; // as allocated, for lfree()
+static uint32_t cache_base;   // rounded up to a multiple of 512
+static uint8_t slot_count;
+static uint16_t use_clock;
+
+static uint32_t slot_sector[SDCACHE_MAX_SLOTS];
+static uint16_t slot_used[SDCACHE_MAX_SLOTS]; // clock of last use, for LRU
+static uint8_t slot_flags[SDCACHE_MAX_SLOTS];
+static uint8_t slot_next[SDCACHE_MAX_SLOTS]; // next slot in hash bucket
+static uint8_t bucket[BUCKETS];
+
+static uint32_t slot_address(const uint8_t slot)
+{
+    return cache_base + ((uint32_t)slot << 9);
+}
+
+static void slot_touch(const uint8_t slot)
+{
+    uint8_t i;
+
+    if (!++use_clock) {
+        // Clock wrapped: restart the ordering
+        for (i = 0; i < slot_count; ++i) {
+            slot_used[i] = 0;
+        }
+        use_clock = 1;
+    }
+    slot_used[slot] = use_clock;
+}
+
+static uint8_t slot_find(const uint32_t sector_number)
+{
+    uint8_t slot = bucket[(uint8_t)sector_number & (BUCKETS - 1)];
+    while (slot != NIL && slot_sector[slot] != sector_number) {
+        slot = slot_next[slot];
+    }
+    return slot;
+}
+
+static uint8_t slot_writeback(const uint8_t slot)
+{
+    uint8_t result;
+
+    if (!(slot_flags[slot] & SLOT_DIRTY)) {
+        return 0;
+    }
+    sdcache_stats.writebacks++;
+    // Write through sector_buffer so that the write policy applies, and
+    // swap rather than copy so that the caller's data there survives
+    lswap(slot_address(slot), (uint32_t)sector_buffer, 512);
+    result = mega65_sdcard_writesector(slot_sector[slot]);
+    lswap(slot_address(slot), (uint32_t)sector_buffer, 512);
+    if (result) {
+        return SDCARD_ERROR;
+    }
+    slot_flags[slot] &= ~SLOT_DIRTY;
+    return 0;
+}
+
+static void slot_unlink(const uint8_t slot)
+{
+    uint8_t* link = &bucket[(uint8_t)slot_sector[slot] & (BUCKETS - 1)];
+    while (*link != slot) {
+        link = &slot_next[*link];
+    }
+    *link = slot_next[slot];
+    slot_flags[slot] = 0;
+}
+
+// Free the least recently used slot and rehash it for a new sector
+static uint8_t slot_claim(const uint32_t sector_number)
+{
+    uint8_t slot = 0;
+    uint8_t i;
+    uint8_t* link;
+
+    for (i = 0; i < slot_count; ++i) {
+        if (!(slot_flags[i] & SLOT_VALID)) {
+            slot = i;
+            break;
+        }
+        if (slot_used[i] < slot_used[slot]) {
+            slot = i;
+        }
+    }
+
+    if (slot_flags[slot] & SLOT_VALID) {
+        if (slot_writeback(slot)) {
+            return NIL;
+        }
+        slot_unlink(slot);
+    }
+
+    link = &bucket[(uint8_t)sector_number & (BUCKETS - 1)];
+    slot_sector[slot] = sector_number;
+    slot_flags[slot] = SLOT_VALID;
+    slot_next[slot] = *link;
+    *link = slot;
+    return slot;
+}
+
+uint8_t sdcache_init(uint8_t slots)
+{
+    uint8_t i;
+
+    if (slot_count) {
+        sdcache_flush();
+        lfree(cache_memory);
+        slot_count = 0;
+    }
+    for (i = 0; i < BUCKETS; ++i) {
+        bucket[i] = NIL;
+    }
+    if (!slots) {
+        return 1;
+    }
+    // lmalloc() aligns to 256 bytes only; align the slots to 512 so that no
+    // slot straddles a 64 kB bank, which a single DMA job cannot cross
+    if (slots > SDCACHE_MAX_SLOTS
+        || !(cache_memory = lmalloc(((uint32_t)slots << 9) + 256))) {
+        return 0;
+    }
+    cache_base = (cache_memory + 511) & ~511UL;
+    for (i = 0; i < slots; ++i) {
+        slot_flags[i] = 0;
+        slot_used[i] = 0;
+    }
+    slot_count = slots;
+    use_clock = 0;
+    return 1;
+}
+
+uint8_t sdcache_read(uint32_t sector_number)
+{
+    uint8_t slot;
+
+    if (!slot_count) {
+        return mega65_sdcard_readsector(sector_number);
+    }
+    slot = slot_find(sector_number);
+    if (slot != NIL) {
+        sdcache_stats.hits++;
+    }
+    else {
+        sdcache_stats.misses++;
+        slot = slot_claim(sector_number);
+        if (slot == NIL) {
+            return SDCARD_ERROR;
+        }
+        if (mega65_sdcard_readsectors(sector_number, 1, slot_address(slot))) {
+            slot_unlink(slot);
+            return SDCARD_ERROR;
+        }
+    }
+    slot_touch(slot);
+    lcopy(slot_address(slot), (uint32_t)sector_buffer, 512);
+    return 0;
+}
+
+uint8_t sdcache_write(uint32_t sector_number)
+{
+    uint8_t slot;
+
+    if (!slot_count) {
+        return mega65_sdcard_writesector(sector_number);
+    }
+    slot = slot_find(sector_number);
+    if (slot != NIL) {
+        sdcache_stats.hits++;
+    }
+    else if ((slot = slot_claim(sector_number)) == NIL) {
+        return SDCARD_ERROR;
+    }
+    slot_touch(slot);
+    lcopy((uint32_t)sector_buffer, slot_address(slot), 512);
+    slot_flags[slot] |= SLOT_DIRTY;
+    return 0;
+}
+
+void sdcache_discard(uint32_t first_sector, uint32_t count)
+{
+    uint8_t i;
+
+    for (i = 0; i < slot_count; ++i) {
+        if ((slot_flags[i] & SLOT_VALID)
+            && slot_sector[i] - first_sector < count) {
+            slot_unlink(i);
+        }
+    }
+}
+
+uint8_t sdcache_flush(void)
+{
+    uint8_t result = 0;
+    uint8_t i;
+
+    for (i = 0; i < slot_count; ++i) {
+        if (slot_writeback(i)) {
+            result = SDCARD_ERROR;
+        }
+    }
+    return result;
+}
@@ -1,10 +1,11 @@
 #include <mega65/sdcard.h>
 #include <mega65/hal.h>
 #include <mega65/memory.h>
+#include <mega65/farmem.h>
 #include <stdio.h>
 #include <string.h>
 
-#define SDCARD_ERROR 0xff;
+#define SDCARD_ERROR 0xff
 
 uint8_t sector_buffer[512];
 
@@ -15,6 +16,36 @@ const uint16_t sd_errorcode = 0xd6daU;
 
 unsigned char sdhc_card = 0;
 
+// Largest card size probed, in sectors (128 GB)
+#define SDCARD_MAX_SECTORS 0x10000000UL
+
+static uint32_t sdcard_size; // cached by mega65_sdcard_getsize()
+
+static uint8_t sdcard_read_sector(
+    const uint32_t sector_number, const uint32_t destination);
+static void sdcard_readahead_stop(void);
+static uint8_t sdcard_sync_begin(void);
+
+struct mega65_sdcard_stats sdcard_stats;
+
+void mega65_sdcard_stats_reset(void)
+{
+    memset(&sdcard_stats, 0, sizeof(sdcard_stats));
+    hal_timer_start();
+}
+
+// Add the time since start to a log2 latency histogram
+static void sdcard_record_latency(uint16_t* histogram, const uint32_t start)
+{
+    uint32_t ticks = hal_timer_ticks() - start;
+    uint8_t bin = 0;
+
+    while ((ticks >>= 1) && bin < SDCARD_LATENCY_BINS - 1) {
+        ++bin;
+    }
+    histogram[bin]++;
+}
+
 void mega65_clear_sector_buffer(void)
 {
     lfill((uint32_t)sector_buffer, 0, 512);
@@ -31,9 +62,11 @@ void mega65_sdcard_reset(void)
     POKE(sd_ctl, 0);
     POKE(sd_ctl, 1);
 
+    sdcard_stats.resets++;
+
     // Now wait for SD card reset to complete
     while (PEEK(sd_ctl) & 3) {
-        POKE(0xd020, (PEEK(0xd020) + 1) & 15);
+        continue;
     }
 
     if (sdhc_card) {
@@ -48,15 +81,43 @@ void mega65_fast(void)
     POKE(0, 65);
 }
 
+// Try reading a sector, resetting the card if that fails
+static uint8_t sdcard_probe(const uint32_t sector_number)
+{
+    if (sdcard_read_sector(sector_number, 0) || (PEEK(sd_ctl) & 0x63)) {
+        mega65_sdcard_reset();
+        return 0;
+    }
+    return 1;
+}
+
+// Read a little-endian 32-bit value that may not be aligned
+static uint32_t sdcard_get32(const uint8_t* bytes)
+{
+    return bytes[0] | ((uint16_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16)
+        | ((uint32_t)bytes[3] << 24);
+}
+
 uint32_t mega65_sdcard_getsize(void)
 {
     // Work out the largest sector number we can read without an error
 
-    uint32_t sector_number = 0x00200000U;
-    uint32_t step = 0x00200000U;
+    uint32_t lo = 0; // readable
+    uint32_t hi;     // not readable
+    uint32_t end;
+    uint32_t step;
+    uint8_t partitions[64];
+    uint8_t* entry;
 
     char result;
 
+    if (sdcard_size) {
+        return sdcard_size;
+    }
+    if (sdcard_sync_begin()) {
+        return 0;
+    }
+
     // Work out if it is SD or SDHC first of all
     // SD cards can't read at non-sector aligned addresses
     mega65_sdcard_reset();
@@ -104,58 +165,44 @@ uint32_t mega65_sdcard_getsize(void)
         sdhc_card = 0;
     }
 
-    if (sdhc_card) {
-        // SDHC claims 32GB limit, and reading from beyond that might cause
-        // trouble. However, 32bits x 512byte sectors = 16TiB addressable.
-        // It thus seems that the top byte of the address may not be safe to
-        // use, or at least the top few bits.
-        sector_number = 0x02000000U;
-        step = sector_number;
-        // write_line("Determining size of SDHC card...",0);
+    // The controller gives no access to the card's CSD register, so the
+    // size is found by probing. Start from the end of the last partition in
+    // the MBR, as that is normally close to the end of the card.
+    if (!sdcard_probe(0)) {
+        return 0;
     }
-    else {
-        //    write_line("Determining size of SD card...",0);
+    lcopy(sd_sectorbuffer + 0x1be, (uint32_t)partitions, 64);
+    for (entry = partitions; entry < partitions + 64; entry += 16) {
+        end = sdcard_get32(entry + 8) + sdcard_get32(entry + 12);
+        if (end > lo + 1 && end <= SDCARD_MAX_SECTORS
+            && sdcard_probe(end - 1)) {
+            lo = end - 1;
+        }
     }
 
-    // Work out size of SD card in a safe way
-    // (binary search of sector numbers is NOT safe for some reason.
-    //  It frequently reports bigger than the size of the card)
-    sector_number = 0;
+    // Grow the step until a read fails, then bisect. Failed reads need a
+    // reset of the card, which sdcard_probe() takes care of.
     step = 16U * 2048U; // = 16MiB
-    while (sector_number < 0x10000000U) {
-        mega65_sdcard_readsector(sector_number);
-        result = PEEK(sd_ctl) & 0x63;
-        if (result) {
-            // Failed to read this, so reduce step size, and then resume.
-
-            // Reset card ready for next try
-            mega65_sdcard_reset();
-
-            sector_number -= step;
-            step = step >> 2;
-            if (!step) {
-                break;
-            }
+    for (hi = lo + step; hi < SDCARD_MAX_SECTORS && sdcard_probe(hi);
+         hi = lo + step) {
+        lo = hi;
+        step <<= 1;
+    }
+    if (hi > SDCARD_MAX_SECTORS) {
+        hi = SDCARD_MAX_SECTORS;
+    }
+    while (hi - lo > 1) {
+        end = lo + ((hi - lo) >> 1);
+        if (sdcard_probe(end)) {
+            lo = end;
+        }
+        else {
+            hi = end;
         }
-        sector_number += step;
-
-        // show card size as we figure it out,
-        // and stay on the same line of output
-        //    show_card_size(sector_number);
-        //    POKE(0xD020U,PEEK(0xD020U)+1);
-        //    screen_line_address-=80;
     }
 
-    // Report number of sectors
-    //  write_line("Maximum readable sector is $",0);
-    //  screen_hex(screen_line_address-80+28,sector_number);
-    //  screen_decimal(screen_line_address,sector_number/1024L);
-    //  write_line("K Sector SD CARD.",6);
-
-    // Work out size in MB and tell user
-    //  show_card_size(sector_number);
-
-    return sector_number;
+    sdcard_size = lo + 1;
+    return sdcard_size;
 }
 
 void mega65_sdcard_open(void)
@@ -181,11 +228,15 @@ void mega65_sdcard_unmap_sector_buffer(void)
 
 unsigned short timeout;
 
-uint8_t mega65_sdcard_readsector(const uint32_t sector_number)
+static uint8_t sdcard_read_sector(
+    const uint32_t sector_number, const uint32_t destination)
 {
     char tries = 0;
 
     uint32_t sector_address = sector_number * 512;
+    if (sdcard_sync_begin()) {
+        return SDCARD_ERROR;
+    }
     if (sdhc_card) {
         sector_address = sector_number;
     }
@@ -212,6 +263,7 @@ uint8_t mega65_sdcard_readsector(const uint32_t sector_number)
         while (PEEK(sd_ctl) & 0x3) {
             timeout--;
             if (!timeout) {
+                sdcard_stats.timeouts++;
                 return SDCARD_ERROR;
             }
             if (PEEK(sd_ctl) & 0x40) {
@@ -232,6 +284,7 @@ uint8_t mega65_sdcard_readsector(const uint32_t sector_number)
         while (PEEK(sd_ctl) & 0x3) {
             timeout--;
             if (!timeout) {
+                sdcard_stats.timeouts++;
                 return SDCARD_ERROR;
             }
             //      write_line("Waiting for read to complete",0);
@@ -250,32 +303,363 @@ uint8_t mega65_sdcard_readsector(const uint32_t sector_number)
 
         if (!(PEEK(sd_ctl) & 0x67)) {
             // Copy data from hardware sector buffer via DMA
-            lcopy(sd_sectorbuffer, (uint32_t)sector_buffer, 512);
+            if (destination) {
+                lcopy(sd_sectorbuffer, destination, 512);
+            }
 
             return 0;
         }
 
-        POKE(0xd020, (PEEK(0xd020) + 1) & 0xf);
-
         // Reset SD card
         mega65_sdcard_open();
 
         tries++;
+        sdcard_stats.retries++;
     }
 
     return SDCARD_ERROR;
 }
 
+// Read a sector and DMA it from the SD buffer to a 28-bit destination. A
+// destination of 0 leaves the data in the SD buffer.
+static uint8_t sdcard_read(
+    const uint32_t sector_number, const uint32_t destination)
+{
+    const uint32_t start = hal_timer_ticks();
+    const uint8_t result = sdcard_read_sector(sector_number, destination);
+
+    sdcard_stats.reads++;
+    if (result) {
+        sdcard_stats.errors++;
+    }
+    sdcard_record_latency(sdcard_stats.read_latency, start);
+    return result;
+}
+
+uint8_t mega65_sdcard_readsectors(
+    uint32_t first_sector, uint16_t count, uint32_t destination)
+{
+    // The controller has no multi-block read command, so sectors are read
+    // one by one, but each goes straight from the SD buffer to destination
+    for (; count; --count, ++first_sector, destination += 512) {
+        if (sdcard_read(first_sector, destination)) {
+            return SDCARD_ERROR;
+        }
+    }
+    return 0;
+}
+
+const uint8_t* mega65_sdcard_acquire(const uint32_t sector_number)
+{
+    if (sdcard_read(sector_number, 0)) {
+        return NULL;
+    }
+    mega65_sdcard_map_sector_buffer();
+    return (const uint8_t*)0xde00U;
+}
+
+void mega65_sdcard_release(void)
+{
+    mega65_sdcard_unmap_sector_buffer();
+}
+
+#define ASYNC_IDLE 0
+#define ASYNC_WAIT_READY 1 // waiting to issue the command
+#define ASYNC_WAIT_START 2 // write issued, waiting for the card to go busy
+#define ASYNC_BUSY 3       // waiting for the command to complete
+
+static volatile uint8_t async_state = ASYNC_IDLE;
+static uint8_t async_command;
+static uint32_t async_sector;
+static uint32_t async_address;
+static uint32_t async_start;
+static mega65_sdcard_callback async_callback;
+
+// Copy a sector with the CPU, so that polling from an interrupt cannot
+// disturb a DMA job being set up by the main program
+static void sdcard_copy_sector(
+    const uint32_t source, const uint32_t destination)
+{
+    lcopy_cpu(source, destination, 0);
+    lcopy_cpu(source + 256, destination + 256, 0);
+}
+
+static uint8_t sdcard_async_finish(const uint8_t result)
+{
+    if (async_command == 3) {
+        sdcard_stats.writes++;
+        sdcard_record_latency(sdcard_stats.write_latency, async_start);
+    }
+    else {
+        sdcard_stats.reads++;
+        sdcard_record_latency(sdcard_stats.read_latency, async_start);
+    }
+    if (result) {
+        sdcard_stats.errors++;
+    }
+    async_state = ASYNC_IDLE;
+    if (async_callback) {
+        async_callback(result);
+    }
+    return result;
+}
+
+// Give up on a command the card did not complete in time
+static uint8_t sdcard_async_timeout(void)
+{
+    sdcard_stats.timeouts++;
+    return sdcard_async_finish(SDCARD_ERROR);
+}
+
+static uint8_t sdcard_submit(const uint8_t command,
+    const uint32_t sector_number, const uint32_t address,
+    const mega65_sdcard_callback callback)
+{
+    if (async_state != ASYNC_IDLE) {
+        return SDCARD_ERROR;
+    }
+    if (!sdhc_card && sector_number >= 0x7fffff) {
+        return SDCARD_ERROR;
+    }
+    async_command = command;
+    async_sector = sdhc_card ? sector_number : sector_number * 512;
+    async_address = address;
+    async_callback = callback;
+    async_start = hal_timer_ticks();
+    async_state = ASYNC_WAIT_READY;
+    mega65_sdcard_poll();
+    return 0;
+}
+
+uint8_t mega65_sdcard_submit_read(const uint32_t sector_number,
+    const uint32_t destination, const mega65_sdcard_callback callback)
+{
+    return sdcard_submit(2, sector_number, destination, callback);
+}
+
+uint8_t mega65_sdcard_submit_write(const uint32_t sector_number,
+    const uint32_t source, const mega65_sdcard_callback callback)
+{
+    return sdcard_submit(3, sector_number, source, callback);
+}
+
+uint8_t mega65_sdcard_poll(void)
+{
+    uint8_t status;
+
+    if (async_state != ASYNC_IDLE
+        && hal_timer_ticks() - async_start > SDCARD_ASYNC_TIMEOUT) {
+        return sdcard_async_timeout();
+    }
+    switch (async_state) {
+    case ASYNC_WAIT_READY:
+        if (PEEK(sd_ctl) & 3) {
+            break;
+        }
+        if (async_command == 3) {
+            sdcard_copy_sector(async_address, sd_sectorbuffer);
+        }
+        POKE(sd_addr + 0, (async_sector >> 0) & 0xff);
+        POKE(sd_addr + 1, (async_sector >> 8) & 0xff);
+        POKE(sd_addr + 2, (async_sector >> 16) & 0xff);
+        POKE(sd_addr + 3, (async_sector >> 24) & 0xff);
+        POKE(sd_ctl, async_command);
+        async_state = async_command == 3 ? ASYNC_WAIT_START : ASYNC_BUSY;
+        break;
+
+    case ASYNC_WAIT_START:
+        status = PEEK(sd_ctl);
+        if (status & 0x40) {
+            return sdcard_async_finish(SDCARD_ERROR);
+        }
+        if (status & 3) {
+            async_state = ASYNC_BUSY;
+        }
+        break;
+
+    case ASYNC_BUSY:
+        status = PEEK(sd_ctl);
+        if (status & 0x40) {
+            return sdcard_async_finish(SDCARD_ERROR);
+        }
+        if (status & 3) {
+            break;
+        }
+        if (status & 0x67) {
+            return sdcard_async_finish(SDCARD_ERROR);
+        }
+        if (async_command == 2 && async_address) {
+            sdcard_copy_sector(sd_sectorbuffer, async_address);
+        }
+        return sdcard_async_finish(0);
+
+    default:
+        return SDCARD_ASYNC_IDLE;
+    }
+    return SDCARD_ASYNC_BUSY;
+}
+
+static uint8_t ra_depth;                // ring size in sectors; 0 = off
+static uint8_t ra_active;               // sequential stream detected
+static uint8_t ra_busy;                 // a prefetch is in flight
+static uint32_t ra_memory;              // as allocated, for lfree()
+static uint32_t ra_ring;                // ring, rounded up to 512 bytes
+static uint32_t ra_last = 0xffffffffUL; // last sector read by the caller
+static uint32_t ra_expected;            // next sector the caller should read
+static uint32_t ra_issued;              // earlier sectors are ready or busy
+
+static uint32_t ra_slot(const uint32_t sector_number)
+{
+    return ra_ring + ((uint32_t)(uint8_t)(sector_number % ra_depth) << 9);
+}
+
+static void sdcard_readahead_fill(void);
+
+static void sdcard_readahead_done(uint8_t result)
+{
+    ra_busy = 0;
+    if (result) {
+        // Drop the failed sector; the caller will read it directly
+        ra_issued--;
+        ra_active = 0;
+        return;
+    }
+    sdcard_readahead_fill();
+}
+
+// Prefetch the next sector if the ring has room
+static void sdcard_readahead_fill(void)
+{
+    if (!ra_active || ra_busy || ra_issued - ra_expected >= ra_depth) {
+        return;
+    }
+    ra_busy = 1;
+    if (mega65_sdcard_submit_read(
+            ra_issued, ra_slot(ra_issued), sdcard_readahead_done)) {
+        ra_busy = 0;
+        return;
+    }
+    ra_issued++;
+}
+
+// Wait for any prefetch in flight and forget the ring
+static void sdcard_readahead_stop(void)
+{
+    uint16_t polls = 0;
+
+    ra_active = 0;
+    while (ra_busy) {
+        // Bounded even if the timer used by the poll timeout is not running
+        if (!++polls) {
+            sdcard_async_timeout();
+            break;
+        }
+        mega65_sdcard_poll();
+    }
+}
+
+// Called before a blocking transfer: the controller must not be in use by
+// a submitted command, which only its own poller may advance
+static uint8_t sdcard_sync_begin(void)
+{
+    sdcard_readahead_stop();
+    return async_state == ASYNC_IDLE ? 0 : SDCARD_ERROR;
+}
+
+static uint8_t sdcard_readahead_read(const uint32_t sector_number)
+{
+    const uint8_t sequential = sector_number == ra_last + 1;
+    uint8_t result;
+
+    ra_last = sector_number;
+    mega65_sdcard_poll();
+
+    if (ra_active && sector_number == ra_expected) {
+        // Wait if this is the sector still being prefetched
+        while (ra_busy && ra_issued - 1 == sector_number) {
+            mega65_sdcard_poll();
+        }
+        if (ra_issued > sector_number) {
+            lcopy(ra_slot(sector_number), (uint32_t)sector_buffer, 512);
+            ra_expected++;
+            sdcard_readahead_fill();
+            return 0;
+        }
+    }
+
+    sdcard_readahead_stop();
+    result = sdcard_read(sector_number, (uint32_t)sector_buffer);
+    if (!result && sequential) {
+        ra_active = 1;
+        ra_expected = ra_issued = sector_number + 1;
+        sdcard_readahead_fill();
+    }
+    return result;
+}
+
+uint8_t mega65_sdcard_readahead(const uint8_t depth)
+{
+    sdcard_readahead_stop();
+    if (ra_depth) {
+        lfree(ra_memory);
+        ra_depth = 0;
+    }
+    if (!depth) {
+        return 1;
+    }
+    // Align like the sector cache so no slot straddles a 64 kB bank
+    if (depth > SDCARD_READAHEAD_MAX
+        || !(ra_memory = lmalloc(((uint32_t)depth << 9) + 256))) {
+        return 0;
+    }
+    ra_ring = (ra_memory + 511) & ~511UL;
+    ra_depth = depth;
+    return 1;
+}
+
+uint8_t mega65_sdcard_readsector(const uint32_t sector_number)
+{
+    if (ra_depth) {
+        return sdcard_readahead_read(sector_number);
+    }
+    return sdcard_read(sector_number, (uint32_t)sector_buffer);
+}
+
 uint8_t verify_buffer[512];
 
+static uint8_t write_policy = SDCARD_WRITE_DEFAULT;
+
+struct mega65_sdcard_write_stats sdcard_write_stats;
+
+void mega65_sdcard_set_write_policy(const uint8_t policy)
+{
+    write_policy = policy;
+}
+
+// Copy the SD card buffer to verify_buffer and compare with sector_buffer
+static uint8_t sdcard_buffer_matches(void)
+{
+    lcopy(sd_sectorbuffer, (uint32_t)verify_buffer, 512);
+    return !memcmp(sector_buffer, verify_buffer, 512);
+}
+
 uint8_t mega65_sdcard_writesector(const uint32_t sector_number)
+{
+    return mega65_sdcard_writesector_policy(sector_number, write_policy);
+}
+
+static uint8_t sdcard_write_sector(
+    const uint32_t sector_number, const uint8_t policy)
 {
     // Copy buffer into the SD card buffer, and then execute the write job
     uint32_t sector_address;
-    int i;
     char tries = 0; // , result;
     uint16_t counter = 0;
 
+    if (sdcard_sync_begin()) {
+        return SDCARD_ERROR;
+    }
+
     while (PEEK(sd_ctl) & 3) {
         continue;
     }
@@ -293,27 +677,21 @@ uint8_t mega65_sdcard_writesector(const uint32_t sector_number)
     POKE(sd_addr + 2, (sector_address >> 16) & 0xff);
     POKE(sd_addr + 3, (sector_address >> 24) & 0xff);
 
-    // Read the sector and see if it already has the correct contents.
-    // If so, nothing to write
-
-    POKE(sd_ctl, 2); // read the sector we just wrote
+    if (policy & SDCARD_WRITE_SKIP_IDENTICAL) {
+        // Read the sector and see if it already has the correct contents.
+        // If so, nothing to write
 
-    while (PEEK(sd_ctl) & 3) {
-        continue;
-    }
+        POKE(sd_ctl, 2); // read the sector
 
-    // Copy the read data to a buffer for verification
-    lcopy(sd_sectorbuffer, (uint32_t)verify_buffer, 512);
+        while (PEEK(sd_ctl) & 3) {
+            continue;
+        }
 
-    // VErify that it matches the data we wrote
-    for (i = 0; i < 512; i++) {
-        if (sector_buffer[i] != verify_buffer[i]) {
-            break;
+        if (sdcard_buffer_matches()) {
+            sdcard_write_stats.skipped++;
+            return 0;
         }
     }
-    if (i == 512) {
-        return 0;
-    }
 
     while (tries < 10) {
 
@@ -327,6 +705,7 @@ uint8_t mega65_sdcard_writesector(const uint32_t sector_number)
             if (!counter) {
 
                 // SD card not becoming ready: try reset
+                sdcard_stats.timeouts++;
                 POKE(sd_ctl, 0); // begin reset
                 usleep(500000);
                 POKE(sd_ctl, 1); // end reset
@@ -350,6 +729,7 @@ uint8_t mega65_sdcard_writesector(const uint32_t sector_number)
             if (!counter) {
 
                 // SD card not becoming ready: try reset
+                sdcard_stats.timeouts++;
                 POKE(sd_ctl, 0); // begin reset
                 usleep(500000);
                 POKE(sd_ctl, 1); // end reset
@@ -360,15 +740,19 @@ uint8_t mega65_sdcard_writesector(const uint32_t sector_number)
         }
 
         write_count++;
-        POKE(0xD020, write_count & 0x0f);
+        sdcard_write_stats.written++;
 
         // Note result
         // result = PEEK(sd_ctl);
 
-        if (!(PEEK(sd_ctl) & 0x67)) {
+        // The card checks the CRC of the data block it received; the
+        // controller reports a bad data response in the status bits
+        if (!(policy & SDCARD_WRITE_CHECK_STATUS) || !(PEEK(sd_ctl) & 0x67)) {
             write_count++;
 
-            POKE(0xD020, write_count & 0x0f);
+            if (!(policy & SDCARD_WRITE_VERIFY)) {
+                return 0;
+            }
 
             // There is a bug in the SD controller: You have to read between
             // writes, or it gets really upset.
@@ -391,19 +775,12 @@ uint8_t mega65_sdcard_writesector(const uint32_t sector_number)
                 continue;
             }
 
-            // Copy the read data to a buffer for verification
-            lcopy(sd_sectorbuffer, (uint32_t)verify_buffer, 512);
-
-            // VErify that it matches the data we wrote
-            for (i = 0; i < 512; i++) {
-                if (sector_buffer[i] != verify_buffer[i]) {
-                    break;
-                }
-            }
-            if (i != 512) {
-                // VErify error has occurred
+            // Verify that it matches the data we wrote
+            if (!sdcard_buffer_matches()) {
+                // Verify error has occurred
                 // write_line("Verify error for sector $$$$$$$$",0);
                 // screen_hex(screen_line_address-80+24,sector_number);
+                sdcard_write_stats.verify_errors++;
             }
             else {
                 //      write_line("Wrote sector $$$$$$$$, result=$$",2);
@@ -414,7 +791,8 @@ uint8_t mega65_sdcard_writesector(const uint32_t sector_number)
             }
         }
 
-        POKE(0xd020, (PEEK(0xd020) + 1) & 0xf);
+        tries++;
+        sdcard_stats.retries++;
     }
 
     //  write_line("Write error @ $$$$$$$$$",2);
@@ -422,70 +800,108 @@ uint8_t mega65_sdcard_writesector(const uint32_t sector_number)
     return SDCARD_ERROR;
 }
 
-void mega65_sdcard_erase(
-    const uint32_t first_sector, const uint32_t last_sector)
+uint8_t mega65_sdcard_writesector_policy(
+    const uint32_t sector_number, const uint8_t policy)
 {
-    uint32_t n;
-    lfill((uint32_t)sector_buffer, 0, 512);
-    lcopy((uint32_t)sector_buffer, sd_sectorbuffer, 512);
+    const uint32_t start = hal_timer_ticks();
+    const uint8_t result = sdcard_write_sector(sector_number, policy);
 
-    //  fprintf(stderr,"ERASING SECTORS %d..%d\r\n",first_sector,last_sector);
+    sdcard_stats.writes++;
+    if (result) {
+        sdcard_stats.errors++;
+    }
+    sdcard_record_latency(sdcard_stats.write_latency, start);
+    return result;
+}
 
-#ifndef NOFAST_ERASE
-    POKE(sd_addr + 0, (first_sector >> 0) & 0xff);
-    POKE(sd_addr + 1, (first_sector >> 8) & 0xff);
-    POKE(sd_addr + 2, (first_sector >> 16) & 0xff);
-    POKE(sd_addr + 3, (first_sector >> 24) & 0xff);
-#endif
+// Wait for the controller to go busy and then ready again
+static void sdcard_wait_command(void)
+{
+    while (!(PEEK(sd_ctl) & 3)) {
+        continue;
+    }
+    while (PEEK(sd_ctl) & 3) {
+        continue;
+    }
+}
 
-    for (n = first_sector; n <= last_sector; n++) {
+// Multi-block write of consecutive sectors. A source address of 0 writes
+// the current contents of the SD card buffer to every sector.
+static uint8_t sdcard_write_multi(
+    const uint32_t first_sector, const uint32_t count, uint32_t source)
+{
+    const uint32_t sector_address
+        = sdhc_card ? first_sector : first_sector * 512;
+    uint8_t result = 0;
+    uint32_t n;
 
-#ifndef NOFAST_ERASE
+    if (!count) {
+        return 0;
+    }
+    if (sdcard_sync_begin()) {
+        return SDCARD_ERROR;
+    }
+
+    POKE(sd_addr + 0, (sector_address >> 0) & 0xff);
+    POKE(sd_addr + 1, (sector_address >> 8) & 0xff);
+    POKE(sd_addr + 2, (sector_address >> 16) & 0xff);
+    POKE(sd_addr + 3, (sector_address >> 24) & 0xff);
+
+    for (n = 0; n < count; n++) {
         // Wait for SD card to go ready
         while (PEEK(sd_ctl) & 3) {
             continue;
         }
 
-        if (n == first_sector) {
-            // First sector of multi-sector write
-            POKE(sd_ctl, 0x04);
-        }
-        else {
-            // All other sectors
-            POKE(sd_ctl, 0x05);
+        if (source) {
+            lcopy(source, sd_sectorbuffer, 512);
+            source += 512;
         }
 
-        // Wait for SD card to go busy
-        while (!(PEEK(sd_ctl) & 3)) {
-            continue;
-        }
+        // First sector of multi-sector write, then all other sectors
+        POKE(sd_ctl, n ? 0x05 : 0x04);
+        sdcard_wait_command();
 
-        // Wait for SD card to go ready
-        while (PEEK(sd_ctl) & 3) {
-            continue;
+        sdcard_stats.writes++;
+        if (PEEK(sd_ctl) & 0x40) {
+            sdcard_stats.errors++;
+            result = SDCARD_ERROR;
+            break;
         }
-
-#else
-        sdcard_writesector(n);
-#endif
-
-        // Show count-down
-        // screen_decimal(screen_line_address,last_sector-n);
-        //    fprintf(stderr,"."); fflush(stderr);
     }
 
-#ifndef NOFAST_ERASE
     // Then say when we are done
     POKE(sd_ctl, 0x06);
+    sdcard_wait_command();
 
-    // Wait for SD card to go busy
-    while (!(PEEK(sd_ctl) & 3)) {
-        continue;
+    return result;
+}
+
+uint8_t mega65_sdcard_writesectors(
+    uint32_t first_sector, uint16_t count, uint32_t source)
+{
+    return sdcard_write_multi(first_sector, count, source);
+}
+
+void mega65_sdcard_erase(
+    const uint32_t first_sector, const uint32_t last_sector)
+{
+#ifdef NOFAST_ERASE
+    uint32_t n;
+#endif
+    if (sdcard_sync_begin()) {
+        return;
     }
+    lfill((uint32_t)sector_buffer, 0, 512);
+    lcopy((uint32_t)sector_buffer, sd_sectorbuffer, 512);
 
-    // Wait for SD card to go ready
-    while (PEEK(sd_ctl) & 3) {
-        continue;
+    //  fprintf(stderr,"ERASING SECTORS %d..%d\r\n",first_sector,last_sector);
+
+#ifndef NOFAST_ERASE
+    sdcard_write_multi(first_sector, last_sector - first_sector + 1, 0);
+#else
+    for (n = first_sector; n <= last_sector; n++) {
+        mega65_sdcard_writesector(n);
     }
 #endif
 }
@@ -0,0 +1,34 @@
+#include <mega65/sdcard.h>
+#include <mega65/debug.h>
+#include <stdio.h>
+
+static char line[80];
+
+static void dump_histogram(const char* name, const uint16_t* histogram)
+{
+    uint8_t bin;
+
+    for (bin = 0; bin < SDCARD_LATENCY_BINS; ++bin) {
+        if (histogram[bin]) {
+            sprintf(line, "%s >= %lu TICKS: %u", name, 1UL << bin,
+                histogram[bin]);
+            debug_msg(line);
+        }
+    }
+}
+
+void mega65_sdcard_stats_dump(void)
+{
+    sprintf(line, "SDCARD READS %lu, WRITES %lu, ERRORS %u", sdcard_stats.reads,
+        sdcard_stats.writes, sdcard_stats.errors);
+    debug_msg(line);
+    sprintf(line, "SDCARD RETRIES %u, TIMEOUTS %u, RESETS %u",
+        sdcard_stats.retries, sdcard_stats.timeouts, sdcard_stats.resets);
+    debug_msg(line);
+    sprintf(line, "SDCARD WRITTEN %lu, SKIPPED %lu, VERIFY ERRORS %lu",
+        sdcard_write_stats.written, sdcard_write_stats.skipped,
+        sdcard_write_stats.verify_errors);
+    debug_msg(line);
+    dump_histogram("READ", sdcard_stats.read_latency);
+    dump_histogram("WRITE", sdcard_stats.write_latency);
+}
@@ -124,71 +124,71 @@ void setrtc(struct m65_tm* tm)
     case TARGET_MEGA65R3:
         // Unlock RTC registers
         usleep(I2CDELAY);
-        lpoke(0xffd7118, 0x41);
+        lpoke_i(0xffd7118, 0x41);
 
         usleep(I2CDELAY);
-        lpoke(0xffd7110, tobcd(tm->tm_sec));
+        lpoke_i(0xffd7110, tobcd(tm->tm_sec));
         usleep(I2CDELAY);
-        lpoke(0xffd7111, tobcd(tm->tm_min));
+        lpoke_i(0xffd7111, tobcd(tm->tm_min));
         if (lpeek_debounced(0xffd7112) & 0x80) {
             usleep(I2CDELAY);
-            lpoke(0xffd7112, tobcd(tm->tm_hour) | 0x80);
+            lpoke_i(0xffd7112, tobcd(tm->tm_hour) | 0x80);
         }
         else {
             if (tm->tm_hour >= 12) {
                 // PM
                 usleep(I2CDELAY);
-                lpoke(0xffd7112, tobcd(tm->tm_hour - 12) | 0x20);
+                lpoke_i(0xffd7112, tobcd(tm->tm_hour - 12) | 0x20);
             }
             else {
                 // AM
                 usleep(I2CDELAY);
-                lpoke(0xffd7112, tobcd(tm->tm_hour));
+                lpoke_i(0xffd7112, tobcd(tm->tm_hour));
             }
         }
 
         usleep(I2CDELAY);
-        lpoke(0xffd7113, tobcd(tm->tm_mday));
+        lpoke_i(0xffd7113, tobcd(tm->tm_mday));
         usleep(I2CDELAY);
-        lpoke(0xffd7114, tobcd(tm->tm_mon));
+        lpoke_i(0xffd7114, tobcd(tm->tm_mon));
         if (tm->tm_year >= 100 && tm->tm_year <= 199) {
             usleep(I2CDELAY);
-            lpoke(0xffd7115, tobcd((uint8_t)(tm->tm_year - 100)));
+            lpoke_i(0xffd7115, tobcd((uint8_t)(tm->tm_year - 100)));
         }
         usleep(I2CDELAY);
-        lpoke(0xffd7116, tobcd(tm->tm_wday));
+        lpoke_i(0xffd7116, tobcd(tm->tm_wday));
         usleep(I2CDELAY);
         if (tm->tm_isdst) {
-            lpoke(0xffd7117, lpeek_debounced(0xffd7117) | 0x20);
+            lpoke_i(0xffd7117, lpeek_debounced(0xffd7117) | 0x20);
         }
         else {
-            lpoke(0xffd7117, lpeek_debounced(0xffd7117) & (0xff - 0x20));
+            lpoke_i(0xffd7117, lpeek_debounced(0xffd7117) & (0xff - 0x20));
         }
 
         // Re-lock RTC registers
         usleep(I2CDELAY);
-        lpoke(0xffd7118, 0x01);
+        lpoke_i(0xffd7118, 0x01);
 
         break;
     case TARGET_MEGA65R4:
     case TARGET_MEGA65R5:
     case TARGET_MEGA65R6:
         usleep(I2CDELAY);
-        lpoke(0xffd7110, tobcd(tm->tm_sec));
+        lpoke_i(0xffd7110, tobcd(tm->tm_sec));
         usleep(I2CDELAY);
-        lpoke(0xffd7111, tobcd(tm->tm_min));
+        lpoke_i(0xffd7111, tobcd(tm->tm_min));
         usleep(I2CDELAY);
-        lpoke(0xffd7112, tobcd(tm->tm_hour)); // no need to set 24h mode, swiss RTC does not have AM/PM
+        lpoke_i(0xffd7112, tobcd(tm->tm_hour)); // no need to set 24h mode, swiss RTC does not have AM/PM
         usleep(I2CDELAY);
-        lpoke(0xffd7113, tobcd(tm->tm_mday));
+        lpoke_i(0xffd7113, tobcd(tm->tm_mday));
         usleep(I2CDELAY);
-        lpoke(0xffd7114, tobcd(tm->tm_mon));
+        lpoke_i(0xffd7114, tobcd(tm->tm_mon));
         if (tm->tm_year >= 100 && tm->tm_year <= 199) {
             usleep(I2CDELAY);
-            lpoke(0xffd7115, tobcd((unsigned char)tm->tm_year - 100));
+            lpoke_i(0xffd7115, tobcd((unsigned char)tm->tm_year - 100));
         }
         usleep(I2CDELAY);
-        lpoke(0xffd7116, tobcd(tm->tm_wday < 7 ? tm->tm_wday : 0));
+        lpoke_i(0xffd7116, tobcd(tm->tm_wday < 7 ? tm->tm_wday : 0));
 
         break;
     case TARGET_MEGAPHONER1:
@@ -0,0 +1,180 @@
+/**
+ * @example bench-memory.c
+ *
+ * Benchmark of the DMA functions in memory.h
+ *
+ * Compares the pre-initialised DMA lists used by `lcopy()` and `lfill()`
+ * with a full list setup on every call, as done by earlier versions of the
+ * library, and the CPU loops used for short blocks with the DMA-only paths to
+ * find the crossover sizes `LCOPY_CPU_MAX` and `LFILL_CPU_MAX`. Timings are
+ * in CIA ticks (~1 us) for 64 calls and are written to
+ * the test log. This can be run in Xemu in testing mode with e.g.
+ *
+ *     xmega65 -testing -headless -sleepless -prg bench-memory.prg
+ */
+#include <mega65/memory.h>
+#include <mega65/hal.h>
+#include <mega65/tests.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define ITERATIONS 64
+#define SOURCE 0x40000UL
+#define DESTINATION 0x50000UL
+
+void do_dma(void);
+
+char msg[80];
+uint16_t i;
+uint32_t start_ticks, legacy_ticks, ticks;
+
+void timer_start(void)
+{
+    start_ticks = hal_timer_ticks();
+}
+
+uint32_t timer_stop(void)
+{
+    return hal_timer_ticks() - start_ticks;
+}
+
+// Copy with every field of the DMA list written on each call
+void legacy_lcopy(
+    uint32_t source_address, uint32_t destination_address, size_t count)
+{
+    dmalist.option_0b = 0x0b;
+    dmalist.option_80 = 0x80;
+    dmalist.source_mb = (uint8_t)(source_address >> 20);
+    dmalist.option_81 = 0x81;
+    dmalist.dest_mb = (uint8_t)(destination_address >> 20);
+    dmalist.option_85 = 0x85;
+    dmalist.dest_skip = 1;
+    dmalist.end_of_options = 0x00;
+    dmalist.sub_cmd = 0x00;
+    dmalist.command = DMA_COPY_CMD;
+    dmalist.count = count;
+    dmalist.source_addr = source_address & 0xffff;
+    dmalist.source_bank = (source_address >> 16) & 0x0f;
+    dmalist.dest_addr = destination_address & 0xffff;
+    dmalist.dest_bank = (destination_address >> 16) & 0x0f;
+    do_dma();
+}
+
+// Fill with every field of the DMA list written on each call
+void legacy_lfill(uint32_t destination_address, uint8_t value, size_t count)
+{
+    dmalist.option_0b = 0x0b;
+    dmalist.option_80 = 0x80;
+    dmalist.source_mb = 0x00;
+    dmalist.option_81 = 0x81;
+    dmalist.dest_mb = (uint8_t)(destination_address >> 20);
+    dmalist.option_85 = 0x85;
+    dmalist.dest_skip = 1;
+    dmalist.end_of_options = 0x00;
+    dmalist.command = DMA_FILL_CMD;
+    dmalist.sub_cmd = 0;
+    dmalist.count = count;
+    dmalist.source_addr = value;
+    dmalist.dest_addr = destination_address & 0xffff;
+    dmalist.dest_bank = (destination_address >> 16) & 0x0f;
+    do_dma();
+}
+
+void bench_copy(size_t count)
+{
+    timer_start();
+    for (i = 0; i < ITERATIONS; i++) {
+        legacy_lcopy(SOURCE, DESTINATION, count);
+    }
+    legacy_ticks = timer_stop();
+
+    timer_start();
+    for (i = 0; i < ITERATIONS; i++) {
+        lcopy_dma(SOURCE, DESTINATION, count);
+    }
+    ticks = timer_stop();
+
+    sprintf(msg, "LCOPY %u BYTES: LEGACY %lu, TEMPLATE %lu", count,
+        legacy_ticks, ticks);
+    unit_test_log(msg);
+}
+
+void bench_fill(size_t count)
+{
+    timer_start();
+    for (i = 0; i < ITERATIONS; i++) {
+        legacy_lfill(DESTINATION, 0x55, count);
+    }
+    legacy_ticks = timer_stop();
+
+    timer_start();
+    for (i = 0; i < ITERATIONS; i++) {
+        lfill_dma(DESTINATION, 0x55, count);
+    }
+    ticks = timer_stop();
+
+    sprintf(msg, "LFILL %u BYTES: LEGACY %lu, TEMPLATE %lu", count,
+        legacy_ticks, ticks);
+    unit_test_log(msg);
+}
+
+// CPU loop versus DMA for short blocks
+void bench_crossover(uint8_t count)
+{
+    uint32_t cpu_ticks;
+
+    timer_start();
+    for (i = 0; i < ITERATIONS; i++) {
+        lcopy_cpu(SOURCE, DESTINATION, count);
+    }
+    cpu_ticks = timer_stop();
+    timer_start();
+    for (i = 0; i < ITERATIONS; i++) {
+        lcopy_dma(SOURCE, DESTINATION, count);
+    }
+    ticks = timer_stop();
+    sprintf(msg, "LCOPY %u BYTES: CPU %lu, DMA %lu", count, cpu_ticks, ticks);
+    unit_test_log(msg);
+
+    timer_start();
+    for (i = 0; i < ITERATIONS; i++) {
+        lfill_cpu(DESTINATION, 0x55, count);
+    }
+    cpu_ticks = timer_stop();
+    timer_start();
+    for (i = 0; i < ITERATIONS; i++) {
+        lfill_dma(DESTINATION, 0x55, count);
+    }
+    ticks = timer_stop();
+    sprintf(msg, "LFILL %u BYTES: CPU %lu, DMA %lu", count, cpu_ticks, ticks);
+    unit_test_log(msg);
+}
+
+int main(void)
+{
+    uint8_t count;
+
+    mega65_io_enable();
+    hal_timer_start();
+
+    bench_copy(1);
+    bench_copy(16);
+    bench_copy(4096);
+
+    bench_fill(1);
+    bench_fill(16);
+    bench_fill(4096);
+
+    for (count = 1; count <= 32; count *= 2) {
+        bench_crossover(count);
+    }
+
+    // Sanity check that the template lists moved the data
+    lfill_dma(SOURCE, 0xa5, 16);
+    lcopy_dma(SOURCE, DESTINATION, 16);
+    assert_eq(lpeek(DESTINATION + 15), 0xa5);
+
+    xemu_exit(EXIT_SUCCESS);
+    return 0;
+}
@@ -0,0 +1,213 @@
+/**
+ * @example bench-sdcard.c
+ *
+ * Benchmark and integrity check of the SD card functions in sdcard.h
+ *
+ * Uses a scratch area of sectors just before the first partition of the SD
+ * card, which is normally unused. The area is saved first and restored at
+ * the end, or before quitting if a check fails. Single-sector, multi-sector,
+ * read-ahead and cached transfers are timed in CIA ticks (~1 us) and the
+ * data read back is compared with what was written. Results are written to
+ * the test log. This can be run in Xemu in testing mode with e.g.
+ *
+ *     xmega65 -testing -headless -sleepless -prg bench-sdcard.prg
+ */
+#include <mega65/sdcard.h>
+#include <mega65/sdcache.h>
+#include <mega65/farmem.h>
+#include <mega65/memory.h>
+#include <mega65/hal.h>
+#include <mega65/tests.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SECTORS 32
+#define CACHED_SECTORS 8
+
+char msg[80];
+uint8_t check[512];
+uint8_t i, pass;
+uint32_t scratch, start_ticks, ticks;
+uint32_t backup, pattern, readback;
+
+void timer_start(void)
+{
+    start_ticks = hal_timer_ticks();
+}
+
+void report(char* name, uint8_t sectors)
+{
+    ticks = hal_timer_ticks() - start_ticks;
+    sprintf(msg, "%s: %lu TICKS/SECTOR, %lu KB/S", name, ticks / sectors,
+        ticks ? sectors * 500000UL / ticks : 0);
+    unit_test_log(msg);
+}
+
+// assert_eq() quits at once, so put the scratch area back before failing
+void expect_eq(uint32_t a, uint32_t b)
+{
+    if (a != b) {
+        sdcache_discard(scratch, SECTORS);
+        mega65_sdcard_writesectors(scratch, SECTORS, backup);
+        assert_eq(a, b);
+    }
+}
+
+// Each write pass uses its own tag for sector n, so that a pass that writes
+// nothing cannot pass on the data left by the one before
+uint8_t tag(uint8_t n)
+{
+    return (uint8_t)(pass * SECTORS + n);
+}
+
+// Sector n holds its tag t, then bytes t + 1, then ~t
+void make_pattern(void)
+{
+    uint8_t t;
+
+    for (i = 0; i < SECTORS; i++) {
+        t = tag(i);
+        lfill(pattern + i * 512UL, (uint8_t)(t + 1), 512);
+        lpoke(pattern + i * 512UL, t);
+        lpoke(pattern + i * 512UL + 511, (uint8_t)~t);
+    }
+}
+
+// Compare a sector in far memory with the pattern written to sector n
+void verify(uint32_t address, uint8_t n)
+{
+    const uint8_t t = tag(n);
+
+    lcopy(address, (uint32_t)check, 512);
+    expect_eq(check[0], t);
+    expect_eq(check[1], (uint8_t)(t + 1));
+    expect_eq(check[511], (uint8_t)~t);
+    expect_eq(memcmp(check + 1, check + 2, 509), 0);
+}
+
+// Read the scratch area back and check the pattern of the current pass
+void verify_scratch(void)
+{
+    expect_eq(mega65_sdcard_readsectors(scratch, SECTORS, readback), 0);
+    for (i = 0; i < SECTORS; i++) {
+        verify(readback + i * 512UL, i);
+    }
+}
+
+int main(void)
+{
+    mega65_io_enable();
+    hal_timer_start();
+    mega65_sdcard_stats_reset();
+
+    mega65_sdcard_open();
+    timer_start();
+    sprintf(msg, "CARD SIZE: %lu SECTORS", mega65_sdcard_getsize());
+    unit_test_log(msg);
+    report("GETSIZE", 1);
+    timer_start();
+    assert_eq(mega65_sdcard_getsize() != 0, 1);
+    report("GETSIZE CACHED", 1);
+
+    // Scratch area ends where the first partition starts
+    assert_eq(mega65_sdcard_readsector(0), 0);
+    memcpy(&scratch, sector_buffer + 0x1be + 8, 4);
+    if (scratch <= SECTORS) {
+        unit_test_log("NO ROOM BEFORE THE FIRST PARTITION");
+        xemu_exit(EXIT_SUCCESS);
+    }
+    scratch -= SECTORS;
+
+    backup = lmalloc(SECTORS * 512UL);
+    pattern = lmalloc(SECTORS * 512UL);
+    readback = lmalloc(SECTORS * 512UL);
+    assert_eq(backup && pattern && readback, 1);
+    assert_eq(mega65_sdcard_readsectors(scratch, SECTORS, backup), 0);
+
+    pass = 0;
+    make_pattern();
+    timer_start();
+    for (i = 0; i < SECTORS; i++) {
+        lcopy(pattern + i * 512UL, (uint32_t)sector_buffer, 512);
+        expect_eq(mega65_sdcard_writesector(scratch + i), 0);
+    }
+    report("WRITESECTOR", SECTORS);
+    verify_scratch();
+
+    pass = 1;
+    make_pattern();
+    timer_start();
+    for (i = 0; i < SECTORS; i++) {
+        lcopy(pattern + i * 512UL, (uint32_t)sector_buffer, 512);
+        expect_eq(mega65_sdcard_writesector_policy(
+                      scratch + i, SDCARD_WRITE_NO_VERIFY),
+            0);
+    }
+    report("WRITESECTOR NO VERIFY", SECTORS);
+    verify_scratch();
+
+    pass = 2;
+    make_pattern();
+    timer_start();
+    expect_eq(mega65_sdcard_writesectors(scratch, SECTORS, pattern), 0);
+    report("WRITESECTORS", SECTORS);
+    verify_scratch();
+
+    timer_start();
+    for (i = 0; i < SECTORS; i++) {
+        expect_eq(mega65_sdcard_readsector(scratch + i), 0);
+    }
+    report("READSECTOR", SECTORS);
+    verify((uint32_t)sector_buffer, SECTORS - 1);
+
+    timer_start();
+    expect_eq(mega65_sdcard_readsectors(scratch, SECTORS, readback), 0);
+    report("READSECTORS", SECTORS);
+    for (i = 0; i < SECTORS; i++) {
+        verify(readback + i * 512UL, i);
+    }
+
+    expect_eq(mega65_sdcard_readahead(4), 1);
+    timer_start();
+    for (i = 0; i < SECTORS; i++) {
+        expect_eq(mega65_sdcard_readsector(scratch + i), 0);
+        verify((uint32_t)sector_buffer, i);
+    }
+    report("READSECTOR WITH READ-AHEAD", SECTORS);
+    expect_eq(mega65_sdcard_readahead(0), 1);
+
+    expect_eq(sdcache_init(CACHED_SECTORS), 1);
+    for (i = 0; i < CACHED_SECTORS; i++) {
+        expect_eq(sdcache_read(scratch + i), 0);
+    }
+    timer_start();
+    for (i = 0; i < CACHED_SECTORS; i++) {
+        expect_eq(sdcache_read(scratch + i), 0);
+        verify((uint32_t)sector_buffer, i);
+    }
+    report("SDCACHE_READ HIT", CACHED_SECTORS);
+
+    pass = 3;
+    make_pattern();
+    timer_start();
+    for (i = 0; i < CACHED_SECTORS; i++) {
+        lcopy(pattern + i * 512UL, (uint32_t)sector_buffer, 512);
+        expect_eq(sdcache_write(scratch + i), 0);
+    }
+    expect_eq(sdcache_flush(), 0);
+    report("SDCACHE_WRITE AND FLUSH", CACHED_SECTORS);
+    expect_eq(sdcache_init(0), 1);
+    expect_eq(
+        mega65_sdcard_readsectors(scratch, CACHED_SECTORS, readback), 0);
+    for (i = 0; i < CACHED_SECTORS; i++) {
+        verify(readback + i * 512UL, i);
+    }
+
+    assert_eq(mega65_sdcard_writesectors(scratch, SECTORS, backup), 0);
+    mega65_sdcard_stats_dump();
+
+    xemu_exit(EXIT_SUCCESS);
+    return 0;
+}
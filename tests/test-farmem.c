@@ -0,0 +1,69 @@
+/**
+ * @example test-farmem.c
+ *
+ * Tests for farmem.h
+ *
+ * This can be run in Xemu in testing mode with e.g.
+ *
+ *     xmega65 -testing -headless -sleepless -prg test-farmem.prg
+ *
+ * If a test fails, xemu will exit with a non-zero return code.
+ */
+#include <mega65/farmem.h>
+#include <mega65/memory.h>
+#include <mega65/tests.h>
+#include <mega65/debug.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define HEAP 0x40000UL
+
+uint32_t a, b, c, d;
+
+int main(void)
+{
+    mega65_io_enable();
+
+    // 16 units of 256 bytes
+    lmalloc_init();
+    assert_eq(lmalloc_add(HEAP, 0x1000), 1);
+
+    debug_msg("TEST: lmalloc()");
+    assert_eq(lmalloc(0), 0);
+    a = lmalloc(256);
+    b = lmalloc(300);
+    c = lmalloc(1);
+    assert_eq(a, HEAP);
+    assert_eq(b, HEAP + 0x100);
+    assert_eq(c, HEAP + 0x300);
+    assert_eq(lmalloc(0x1000), 0);
+
+    debug_msg("TEST: lfree() reuses and merges blocks");
+    lfree(b);
+    d = lmalloc(512);
+    assert_eq(d, HEAP + 0x100);
+    lfree(a);
+    lfree(d);
+    a = lmalloc(768);
+    assert_eq(a, HEAP);
+
+    debug_msg("TEST: lrealloc()");
+    // Grows in place into the free space after c
+    assert_eq(lrealloc(c, 1024), c);
+    // c is in the way, so a moves behind it and keeps its contents
+    lpoke(a + 767, 0x5a);
+    b = lrealloc(a, 0x800);
+    assert_eq(b, HEAP + 0x700);
+    assert_eq(lpeek(b + 767), 0x5a);
+    // Too large: the block is left untouched
+    assert_eq(lrealloc(b, 0x1000), 0);
+    assert_eq(lpeek(b + 767), 0x5a);
+    // The old block of a is free again
+    assert_eq(lmalloc(768), HEAP);
+    // Shrinking releases the tail
+    assert_eq(lrealloc(b, 256), b);
+    assert_eq(lmalloc(0x700), HEAP + 0x800);
+
+    xemu_exit(EXIT_SUCCESS);
+    return 0;
+}
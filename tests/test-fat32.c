@@ -0,0 +1,86 @@
+/**
+ * @example test-fat32.c
+ *
+ * Tests for fat32.h, reading CHARROM.M65 from the SD card
+ *
+ * This can be run in Xemu in testing mode with e.g.
+ *
+ *     xmega65 -testing -headless -sleepless -prg test-fat32.prg
+ *
+ * If a test fails, Xemu exits with a non-zero return code.
+ */
+#include <mega65/fat32.h>
+#include <mega65/sdcard.h>
+#include <mega65/memory.h>
+#include <mega65/farmem.h>
+#include <mega65/tests.h>
+#include <mega65/debug.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define FAT32_ERROR 0xff
+// The driver allocates from the far heap, so keep the heap to bank 5 and
+// read files into bank 4
+#define HEAP_START 0x50000UL
+#define HEAP_SIZE 0x10000UL
+#define DESTINATION 0x40000UL
+
+// Input file on SD card: CHARROM.M65, in lower case ASCII
+char filename[11 + 1] = { 0x63, 0x68, 0x61, 0x72, 0x72, 0x6f, 0x6d, 0x2e, 0x6d,
+    0x36, 0x35, 0x00 };
+char* unknown_filename = "PHANTOM_FILE";
+struct mega65_fat32_file file;
+uint32_t reads;
+
+int main(void)
+{
+    mega65_io_enable();
+    mega65_sdcard_open();
+    assert_eq(lmalloc_add(HEAP_START, HEAP_SIZE), 1);
+
+    debug_msg("TEST: mega65_fat32_mount()");
+    assert_eq(mega65_fat32_mount(0), 0);
+    assert_eq(mega65_fat32_free_clusters() != 0, 1);
+
+    debug_msg("TEST: mega65_fat32_open()");
+    assert_eq(mega65_fat32_open(&file, unknown_filename), FAT32_ERROR);
+    assert_eq(mega65_fat32_open(&file, filename), 0);
+    assert_eq(file.size, 4096);
+
+    // The root directory is indexed now, so it is not read again
+    debug_msg("TEST: mega65_fat32_open() with directory index");
+    mega65_fat32_close(&file);
+    reads = sdcard_stats.reads;
+    assert_eq(mega65_fat32_open(&file, unknown_filename), FAT32_ERROR);
+    assert_eq(sdcard_stats.reads, reads);
+    assert_eq(mega65_fat32_open(&file, filename), 0);
+
+    // Same contents as in test-fileio.c
+    debug_msg("TEST: mega65_fat32_read()");
+    assert_eq(mega65_fat32_read(&file, DESTINATION, 8192), 4096);
+    assert_eq(lpeek(DESTINATION), 0x3c);
+    assert_eq(lpeek(DESTINATION + 1), 0x66);
+    assert_eq(lpeek(DESTINATION + 510), 0x18);
+    assert_eq(lpeek(DESTINATION + 511), 0x00);
+    assert_eq(lpeek(DESTINATION + 4095), 0xf0);
+    assert_eq(mega65_fat32_read(&file, DESTINATION, 1), 0);
+
+    debug_msg("TEST: mega65_fat32_seek()");
+    assert_eq(mega65_fat32_seek(&file, 4097), FAT32_ERROR);
+    assert_eq(mega65_fat32_seek(&file, 511), 0);
+    assert_eq(mega65_fat32_read(&file, DESTINATION, 2), 2);
+    assert_eq(lpeek(DESTINATION), 0x00);
+    assert_eq(file.position, 513);
+
+    debug_msg("TEST: mega65_fat32_read_far()");
+    assert_eq(file.run_count != 0, 1);
+    assert_eq(mega65_fat32_read_far(&file, 4094, DESTINATION, 8), 2);
+    assert_eq(lpeek(DESTINATION + 1), 0xf0);
+    assert_eq(mega65_fat32_read_far(&file, 510, DESTINATION, 2), 2);
+    assert_eq(lpeek(DESTINATION), 0x18);
+    assert_eq(file.position, 513);
+    mega65_fat32_close(&file);
+
+    xemu_exit(EXIT_SUCCESS);
+    return 0;
+}
@@ -15,6 +15,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+struct dmagic_dmalist batch_jobs[2];
+struct dma_batch batch;
+
 int main(void)
 {
     mega65_io_enable();
@@ -57,6 +60,16 @@ int main(void)
     assert_eq(lpeek_i(0x4002), 7);
 #endif
 
+    // Constant-address variants
+    debug_msg("TEST: lpoke_i(), lfill_i() and lcopy_i()");
+    lpoke_i(0x4003, 5);
+    assert_eq(lpeek(0x4003), 5);
+    lfill_i(0x5000, 3, 2);
+    lcopy_i(0x4002, 0x5001, 2);
+    assert_eq(PEEK(0x5000), 3);
+    assert_eq(PEEK(0x5001), 7);
+    assert_eq(PEEK(0x5002), 5);
+
     // dma_poke and dma_peek
     debug_msg("TEST: dma_poke() and dma_peek()");
     dma_poke(0x4000, 9);
@@ -81,6 +94,104 @@ int main(void)
     assert_eq(PEEK(0x3001), 1);
     assert_eq(PEEK(0x3002), 0);
 
+    // CPU and DMA-only paths on either side of the crossover
+    debug_msg("TEST: lcopy_cpu(), lfill_cpu(), lcopy_dma() and lfill_dma()");
+    lfill_dma(0x4000, 0x5a, LFILL_CPU_MAX + 1);
+    lfill_cpu(0x4001, 0xa5, 2);
+    assert_eq(PEEK32(0x4000), 0x5aa5a55a);
+    lcopy_cpu(0x4000, 0x5000, 4);
+    assert_eq(PEEK32(0x5000), 0x5aa5a55a);
+    lcopy_dma(0x4001, 0x5001, LCOPY_CPU_MAX + 1);
+    assert_eq(PEEK32(0x5000), 0x5aa5a55a);
+    assert_eq(PEEK(0x5000 + LCOPY_CPU_MAX + 1), 0x5a);
+
+    // 16- and 32-bit pattern fills
+    debug_msg("TEST: lfill16() and lfill32()");
+    lfill32(0x4000, 0x44332211, 2);
+    assert_eq(PEEK32(0x4000), 0x44332211);
+    assert_eq(PEEK32(0x4004), 0x44332211);
+    lfill16(0x4001, 0x6655, 3);
+    assert_eq(PEEK32(0x4000), 0x55665511);
+    assert_eq(PEEK32(0x4004), 0x44665566);
+
+    // lmove with overlap in both directions
+    debug_msg("TEST: lmove()");
+    POKE32(0x3000, 0x04030201);
+    lmove(0x3000, 0x3001, 3);
+    assert_eq(PEEK32(0x3000), 0x03020101);
+    lmove(0x3001, 0x3000, 3);
+    assert_eq(PEEK32(0x3000), 0x03030201);
+
+    // lcopy_skip: gather every second byte, then scatter it back
+    debug_msg("TEST: lcopy_skip()");
+    POKE32(0x3000, 0x04030201);
+    lcopy_skip(0x3000, 2, 0x4000, 1, 2);
+    assert_eq(PEEK(0x4000), 1);
+    assert_eq(PEEK(0x4001), 3);
+    lfill(0x3000, 0, 4);
+    lcopy_skip(0x4000, 1, 0x3001, 2, 2);
+    assert_eq(PEEK(0x3000), 0);
+    assert_eq(PEEK(0x3001), 1);
+    assert_eq(PEEK(0x3002), 0);
+    assert_eq(PEEK(0x3003), 3);
+
+    // lswap
+    debug_msg("TEST: lswap()");
+    lfill(0x3000, 1, 3);
+    lfill(0x4000, 2, 3);
+    lswap(0x3000, 0x4000, 3);
+    assert_eq(PEEK(0x3000), 2);
+    assert_eq(PEEK(0x3002), 2);
+    assert_eq(PEEK(0x4000), 1);
+    assert_eq(PEEK(0x4002), 1);
+
+    // lmix with each minterm combination: source 0x0c, destination 0x0a
+    debug_msg("TEST: lmix()");
+    lfill(0x3000, 0x0c, 1);
+    lfill(0x4000, 0x0a, 3);
+    lmix(0x3000, 0x4000, 1, DMA_MIX_AND);
+    lmix(0x3000, 0x4001, 1, DMA_MIX_OR);
+    lmix(0x3000, 0x4002, 1, DMA_MIX_XOR);
+    assert_eq(PEEK(0x4000), 0x08);
+    assert_eq(PEEK(0x4001), 0x0e);
+    assert_eq(PEEK(0x4002), 0x06);
+    assert_eq(PEEK(0x3000), 0x0c);
+
+    // rectangles: 2x3 bytes with a stride of 4
+    debug_msg("TEST: lfill_rect() and lcopy_rect()");
+    lfill(0x3000, 0, 16);
+    lfill_rect(0x3001, 4, 7, 2, 3);
+    assert_eq(PEEK(0x3000), 0);
+    assert_eq(PEEK(0x3001), 7);
+    assert_eq(PEEK(0x3002), 7);
+    assert_eq(PEEK(0x3003), 0);
+    assert_eq(PEEK(0x3009), 7);
+    assert_eq(PEEK(0x300a), 7);
+    assert_eq(PEEK(0x300d), 0);
+    // move down by one row; overlapping rows must survive
+    lcopy_rect(0x3001, 4, 0x3005, 4, 2, 3);
+    assert_eq(PEEK(0x300d), 7);
+    assert_eq(PEEK(0x300e), 7);
+    // shift right by one byte within the rows
+    POKE32(0x3000, 0x04030201);
+    POKE32(0x3004, 0x08070605);
+    lcopy_rect(0x3000, 4, 0x3001, 4, 3, 2);
+    assert_eq(PEEK32(0x3000), 0x03020101);
+    assert_eq(PEEK32(0x3004), 0x07060505);
+
+    // chained DMA jobs; the third job overflows the arena
+    debug_msg("TEST: dma_batch");
+    dma_batch_begin(&batch, batch_jobs, 2);
+    dma_batch_fill(&batch, 0x3000, 5, 3);
+    dma_batch_copy(&batch, 0x3000, 0x4000, 3);
+    dma_batch_fill(&batch, 0x3001, 6, 1);
+    assert_eq(PEEK(0x4000), 5);
+    assert_eq(PEEK(0x4002), 5);
+    assert_eq(PEEK(0x3001), 5);
+    dma_batch_submit(&batch);
+    assert_eq(PEEK(0x3001), 6);
+    assert_eq(batch.count, 0);
+
     // POKE16 and PEEK16 macros
     debug_msg("TEST: poke/peek 16");
     POKE16(0x3000, 0xAABB);